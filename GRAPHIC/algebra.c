@@ -44,7 +44,7 @@ int TrimLineFindX(int x0, int y0, int x1, int y1, int y){
 	};
 	int dx = x1 - x0;
 	int delta_y = y - y0;
-	int new_x = x0 + (int)( (float)(dx * delta_y) / dy );
+	int new_x = x0 + (int)( (float)dx * delta_y / dy );
 	return new_x;
 };
 
@@ -55,7 +55,7 @@ int TrimLineFindY(int x0, int y0, int x1, int y1, int x){
 	};
 	int dy = y1 - y0;
 	int delta_x = x - x0;
-	int new_y = y0 + (int)( (float)(dy * delta_x) / dx );
+	int new_y = y0 + (int)( (float)dy * delta_x / dx );
 	return new_y;
 };
 #endif
@@ -49,6 +49,8 @@ typedef int fixed;
 #define FIXED_TO_INT(f) ( (f) >> N )
 #define INT_TO_FIXED(f) ( (f) << N )
 #define ABS(number) ( ((number) >= 0)?(number):(-(number)) )
+#define MIN(a,b) ( ((a) < (b))?(a):(b) )
+#define MAX(a,b) ( ((a) > (b))?(a):(b) )
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -130,4 +132,39 @@ static inline void Barycentric(int x, int y, vector p0, vector p1, vector p2,
 	*lambda2 = 1.0f - *lambda0 - *lambda1;
 }
 
+/*screen-space plane of an attribute: value(x,y) = dx*x + dy*y + c
+  p0,p1,p2 - screen x,y of the triangle corners and the value in [Z]*/
+typedef struct {
+	float dx;
+	float dy;
+	float c;
+} plane;
+
+static inline void PlaneSetup(vector p0, vector p1, vector p2, plane *pl){
+	float area = (p1[X] - p0[X]) * (p2[Y] - p0[Y]) -
+		     (p2[X] - p0[X]) * (p1[Y] - p0[Y]);
+	if(area == 0){
+		pl->dx = 0;
+		pl->dy = 0;
+		pl->c = (p0[Z] + p1[Z] + p2[Z]) / 3;
+		return;
+	};
+	pl->dx = ((p1[Z] - p0[Z]) * (p2[Y] - p0[Y]) -
+		  (p2[Z] - p0[Z]) * (p1[Y] - p0[Y])) / area;
+	pl->dy = ((p2[Z] - p0[Z]) * (p1[X] - p0[X]) -
+		  (p1[Z] - p0[Z]) * (p2[X] - p0[X])) / area;
+	pl->c = p0[Z] - pl->dx * p0[X] - pl->dy * p0[Y];
+}
+
+/*plane of attribute values a0,a1,a2 given in the corners p0,p1,p2*/
+static inline void AttributeSetup(vector p0, vector p1, vector p2,
+				float a0, float a1, float a2, plane *pl){
+	vector q0 = {p0[X], p0[Y], a0};
+	vector q1 = {p1[X], p1[Y], a1};
+	vector q2 = {p2[X], p2[Y], a2};
+	PlaneSetup(q0, q1, q2, pl);
+}
+
+#define PLANE_AT(pl,x,y) ((pl).dx * (x) + (pl).dy * (y) + (pl).c)
+
 #endif //SENTRY
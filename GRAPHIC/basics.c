@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "basics.h"
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
@@ -48,18 +49,25 @@ static void InversePlot(window *w,int x,int y,int color);
 static void Bresenham(Handler Plot, window *w,
 			int x0, int y0, int x1, int y1, int color);
 static void Rasterize(window *w,
-		   int x1,int y1,int x2,int y2,int x3,int y3,
-		   Plotter Plot, int color, void *userdata);
+		   int x1,int y1,int x2,int y2,int x3,int y3, scissor *clip,
+		   SpanPlotter Span, int color, void *userdata);
+static void RasterizePixels(window *w,
+		   int x1,int y1,int x2,int y2,int x3,int y3, scissor *clip,
+		   SpanPlotter Span, int color, void *userdata);
+static void PixelSpan(window *w,int x0,int x1,int y,int color,void *userdata);
 static void Intersect(int code, int max, int x0, int y0,
 			int x1, int y1, int *nx, int *ny);
 static void SutherlandHodgman(window *w,
 			int x0, int y0,
 			int x1, int y1,
-			int x2, int y2,
-			Plotter Plot, int color, void *userdata);
+			int x2, int y2, scissor *clip,
+			SpanPlotter Span, int color, void *userdata);
 static int ClipFill(window *w, int *x0, int *y0, int *x1, int *y1);
+static void FillSpan(window *w, framebuffer *fb,
+			int x, int y, int count, int color);
 static int ClipRectangle(window *w, int *x0, int *y0, int *x1, int *y1);
-static int TriangleCheck(window *w,int x1,int y1,int x2,int y2,int x3,int y3);
+static int TriangleCheck(scissor *clip,int x1,int y1,int x2,int y2,int x3,int y3);
+static int GuardBand(scissor *clip,int x1,int y1,int x2,int y2,int x3,int y3);
 static int DecodeUTF8(char **text);
 
 struct font_t{
@@ -67,6 +75,11 @@ struct font_t{
 	char *buffer;
 };
 
+typedef struct { /*userdata of PixelSpan*/
+	Plotter Plot;
+	void *userdata;
+} pixel_span;
+
 /*_____________MAIN FUNCS (DRAWERS)_____________*/
 
 void DrawAlphaPixel(window *w, int x, int y, int color){
@@ -113,17 +126,44 @@ void DrawLine(window *w, int x0, int y0, int x1, int y1, int color){
 
 void DrawTriangle(window *w, int x1,int y1,int x2,int y2,int x3,int y3,
 		    Plotter Plot, int color, void *userdata){
-	if( TriangleCheck(w,x1,y1,x2,y2,x3,y3) ) /*100% out of canvas*/
+	pixel_span data = {Plot, userdata};
+	DrawTriangleSpans(w,x1,y1,x2,y2,x3,y3,PixelSpan,color,&data);
+};
+
+void DrawTriangleSpans(window *w, int x1,int y1,int x2,int y2,int x3,int y3,
+		    SpanPlotter Span, int color, void *userdata){
+	scissor canvas = {0, 0, io_GetWidth(w) - 1, io_GetHeight(w) - 1};
+	DrawTriangleScissor(w,x1,y1,x2,y2,x3,y3,&canvas,Span,color,userdata);
+};
+
+void DrawTriangleScissor(window *w, int x1,int y1,int x2,int y2,int x3,int y3,
+		    scissor *clip, SpanPlotter Span, int color, void *userdata){
+	if( TriangleCheck(clip,x1,y1,x2,y2,x3,y3) ) /*100% out of scissor*/
 		return;
-	int mx = io_GetWidth(w);
-	int my = io_GetHeight(w);
-	if((ComputeOutCode(mx,my,x1,y1)|ComputeOutCode(mx,my,x2,y2)|
-		/*100% on canvas*/	ComputeOutCode(mx,my,x3,y3)) == 0){
-		Rasterize(w,x1,y1,x2,y2,x3,y3,Plot,color,userdata);
+	if( GuardBand(clip,x1,y1,x2,y2,x3,y3) ){
+		/*spans are cut by the scissor, no polygon clipping needed*/
+		RasterizePixels(w,x1,y1,x2,y2,x3,y3,clip,Span,color,userdata);
 		return;
 	};
-	/*split into several triangles and draw*/
-	SutherlandHodgman(w,x1,y1,x2,y2,x3,y3,Plot,color,userdata);
+	/*too far out: split into several triangles in the scissor*/
+	SutherlandHodgman(w,x1,y1,x2,y2,x3,y3,clip,Span,color,userdata);
+};
+
+void DrawTriangleSubpixel(window *w, fixed x1, fixed y1, fixed x2, fixed y2,
+		fixed x3, fixed y3, scissor *clip, SpanPlotter Span,
+		int color, void *userdata){
+#ifdef _HALFSPACE
+	if( GuardBand(clip,FIXED_TO_INT(x1),FIXED_TO_INT(y1),FIXED_TO_INT(x2),
+			FIXED_TO_INT(y2),FIXED_TO_INT(x3),FIXED_TO_INT(y3)) ){
+		Rasterize(w,x1,y1,x2,y2,x3,y3,clip,Span,color,userdata);
+		return;
+	};
+#endif
+	/*scanlines and the clipper take whole pixels: corners go to the
+	  pixel under them*/
+	DrawTriangleScissor(w,FIXED_TO_INT(x1),FIXED_TO_INT(y1),
+		FIXED_TO_INT(x2),FIXED_TO_INT(y2),FIXED_TO_INT(x3),
+		FIXED_TO_INT(y3),clip,Span,color,userdata);
 };
 
 void DrawImage(window *w, int x0, int y0, int *image){
@@ -154,11 +194,12 @@ void DrawFill(window *w, int x0, int y0, int x1, int y1, int color){
 	if( ClipFill(w, &x0, &y0, &x1, &y1) ){
 		return;
 	}
-	for(int x = x0; x < x0 + x1; x++){
-		 for(int y = y0; y < y0 + y1; y++){
-		 	io_SetPixel(w, x, y, color);
-		 };
+	framebuffer fb;
+	io_LockFrame(w, &fb);
+	for(int y = y0; y <= y1; y++){
+		FillSpan(w, &fb, x0, y, x1 - x0 + 1, color);
 	};
+	io_UnlockFrame(w);
 };
 
 void DrawRectangle(window *w, int x0, int y0, int x1, int y1, int color){
@@ -169,15 +210,15 @@ void DrawRectangle(window *w, int x0, int y0, int x1, int y1, int color){
 		swap_xy(&y0, &y1);
 	if( ClipRectangle(w, &x0, &y0, &x1, &y1) )
 		return;
-	for(int x = x0; x <= x1; x++){
-		if(x >= width)
-			break;
-		if (y0 >= 0 && y0 < height)
-			io_SetPixel(w, x, y0, color); /* Up Line */
-		if (y1 >= 0 && y1 < height)
-			io_SetPixel(w, x, y1, color); /* Down Line */
-	}
-	for(int y = y0; y <= y1; y++) {
+	int left = MAX(x0, 0), right = MIN(x1, width - 1);
+	framebuffer fb;
+	io_LockFrame(w, &fb);
+	if (y0 >= 0 && y0 < height)
+		FillSpan(w, &fb, left, y0, right - left + 1, color); /* Up Line */
+	if (y1 >= 0 && y1 < height && y1 != y0)
+		FillSpan(w, &fb, left, y1, right - left + 1, color); /* Down Line */
+	io_UnlockFrame(w);
+	for(int y = MAX(y0, 0); y <= y1; y++) {
 		if(y >= height)
 			break;
 		if (x0 >= 0 && x0 < width)	
@@ -201,16 +242,17 @@ void DrawGradient(window *w, int x0, int y0, int x1, int y1, int c0, int c1) {
 	int r0,g0,b0,r1,g1,b1;
 	UnmixColor(c0, &r0, &g0, &b0);
 	UnmixColor(c1, &r1, &g1, &b1);
-	for (int x = x0; x <= x1; x++) {
-		for (int y = y0; y <= y1; y++) {
-			float factorY = (float)(y - y0)/(y1 - y0);
-			int r = r0 + (int)((r1 - r0)*factorY);
-			int g = g0 + (int)((g1 - g0)*factorY);
-			int b = b0 + (int)((b1 - b0)*factorY);
-			int color = MixColor(r,g,b);
-			io_SetPixel(w, x, y, color);
-		}
+	framebuffer fb;
+	io_LockFrame(w, &fb);
+	for (int y = y0; y <= y1; y++) {
+		float factorY = (float)(y - y0)/(y1 - y0);
+		int r = r0 + (int)((r1 - r0)*factorY);
+		int g = g0 + (int)((g1 - g0)*factorY);
+		int b = b0 + (int)((b1 - b0)*factorY);
+		int color = MixColor(r,g,b);
+		FillSpan(w, &fb, x0, y, x1 - x0 + 1, color);
 	}
+	io_UnlockFrame(w);
 }
 #endif
 
@@ -228,23 +270,18 @@ void DrawGradient(window *w, int x0, int y0, int x1, int y1, int c0, int c1){
 	int r0,g0,b0,r1,g1,b1;
 	UnmixColor(c0, &r0, &g0, &b0);
 	UnmixColor(c1, &r1, &g1, &b1);
-	for (int x = x0; x <= x1; x++) {
-		for (int y = y0; y <= y1; y++) {
-			fixed factorY = div(INT_TO_FIXED(y - y0),
-					    INT_TO_FIXED(y1 - y0));
-			int r = r0 + FIXED_TO_INT(mul(
-						INT_TO_FIXED(r1 - r0),
-						factorY));
-			int g = g0 + FIXED_TO_INT(mul(
-						INT_TO_FIXED(g1 - g0),
-						factorY));
-			int b = b0 + FIXED_TO_INT(mul(
-						INT_TO_FIXED(b1 - b0),
-						factorY));
-			int color = MixColor(r,g,b);
-			io_SetPixel(w, x, y, color);
-		}
+	framebuffer fb;
+	io_LockFrame(w, &fb);
+	for (int y = y0; y <= y1; y++) {
+		fixed factorY = div(INT_TO_FIXED(y - y0),
+				    INT_TO_FIXED(y1 - y0));
+		int r = r0 + FIXED_TO_INT(mul(INT_TO_FIXED(r1 - r0), factorY));
+		int g = g0 + FIXED_TO_INT(mul(INT_TO_FIXED(g1 - g0), factorY));
+		int b = b0 + FIXED_TO_INT(mul(INT_TO_FIXED(b1 - b0), factorY));
+		int color = MixColor(r,g,b);
+		FillSpan(w, &fb, x0, y, x1 - x0 + 1, color);
 	}
+	io_UnlockFrame(w);
 }
 #endif
 
@@ -301,6 +338,14 @@ void DefaultPlot(window *w,int x,int y,int color,void *userdata){
 	io_SetPixel(w,x,y,color);
 };
 
+/*adapter: feeds the pixels of a span to a Plotter*/
+static void PixelSpan(window *w,int x0,int x1,int y,int color,void *userdata){
+	pixel_span *data = (pixel_span *)userdata;
+	for(int x = x0; x <= x1; x++){
+		(data->Plot)(w, x, y, color, data->userdata);
+	};
+};
+
 font* LoadFont(char* path){
 	FILE* f_file = fopen(path, "rb");
 	if (!f_file) {
@@ -423,15 +468,17 @@ static void Bresenham(Handler Plot, window *w,
 	};
 };
 
-#ifndef _FIXED_POINT
+#if !defined(_FIXED_POINT) && !defined(_HALFSPACE)
 static void Rasterize(window *w, /*draws triangle*/
-		   int x1,int y1,int x2,int y2,int x3,int y3,
-		   Plotter Plot, int color, void *userdata) {
+		   int x1,int y1,int x2,int y2,int x3,int y3, scissor *clip,
+		   SpanPlotter Span, int color, void *userdata) {
 	if (y1 > y2) { swap_xy(&x1, &x2); swap_xy(&y1, &y2); }
 	if (y1 > y3) { swap_xy(&x1, &x3); swap_xy(&y1, &y3); }
 	if (y2 > y3) { swap_xy(&x2, &x3); swap_xy(&y2, &y3); }
 	int max = y3 - y1;
-	for (int i = 0; i < max; i++) {
+	/*only rows of the scissor*/
+	int last = MIN(max, clip->y1 - y1 + 1);
+	for (int i = MAX(0, clip->y0 - y1); i < last; i++) {
 		int half = i > y2 - y1 || y2 == y1;
 		int seg = half ? y3 - y2 : y2 - y1;
 		float alpha = (float)i / max;
@@ -442,53 +489,182 @@ static void Rasterize(window *w, /*draws triangle*/
 		if (a > b) {
 			swap_xy(&a, &b);
 		}
-		for (int x = a; x <= b; x++) {
-			(Plot)(w, x, h, color,userdata);
-		}
+		a = MAX(a, clip->x0); b = MIN(b, clip->x1);
+		if (a <= b)
+			(Span)(w, a, b, h, color, userdata);
 	}
 };
 #endif
 
-#ifdef _FIXED_POINT
+#if defined(_FIXED_POINT) && !defined(_HALFSPACE)
 static void Rasterize(window *w, /*draws triangle*/
-		   int x1,int y1,int x2,int y2,int x3,int y3,
-		   Plotter Plot, int color, void *userdata) {
+		   int x1,int y1,int x2,int y2,int x3,int y3, scissor *clip,
+		   SpanPlotter Span, int color, void *userdata) {
 	if (y1 > y2) { swap_xy(&x1, &x2); swap_xy(&y1, &y2); }
 	if (y1 > y3) { swap_xy(&x1, &x3); swap_xy(&y1, &y3); }
 	if (y2 > y3) { swap_xy(&x2, &x3); swap_xy(&y2, &y3); }
 	int max = y3 - y1;
-	for (int i = 0; i < max; i++) {
+	/*only rows of the scissor*/
+	int last = MIN(max, clip->y1 - y1 + 1);
+	for (int i = MAX(0, clip->y0 - y1); i < last; i++) {
 		int half = i > y2 - y1 || y2 == y1;
 		int seg = half ? y3 - y2 : y2 - y1;
-		fixed alpha = div(INT_TO_FIXED(i),INT_TO_FIXED(max));
-		fixed delta = INT_TO_FIXED( (i - ((half)?(y2 - y1):(0)) ));
-		fixed beta  = div(delta, INT_TO_FIXED(seg));
-		int a = x1 + FIXED_TO_INT( mul(INT_TO_FIXED(x3-x1),alpha) );
-		int b = half ? 
-			(x2 +  FIXED_TO_INT(mul(INT_TO_FIXED(x3-x2),beta)) ) 
+		/*exact integer ratios: 28.4 alpha and beta have only 16 steps,
+		  too coarse for triangles reaching into the guard band*/
+		int delta = i - ((half)?(y2 - y1):(0));
+		int a = x1 + (int)((int64_t)(x3 - x1) * i / max);
+		int b = half ?
+			(x2 + (int)((int64_t)(x3 - x2) * delta / seg))
 			:
-			(x1 +  FIXED_TO_INT(mul(INT_TO_FIXED(x2-x1),beta )));
+			(x1 + (int)((int64_t)(x2 - x1) * delta / seg));
 		int h = y1 + i; /*draw horizontal line a,b,h*/
 		if (a > b) {
 			swap_xy(&a, &b);
 		}
-		for (int x = a; x <= b; x++) {
-			(Plot)(w, x, h, color,userdata);
-		}
+		a = MAX(a, clip->x0); b = MIN(b, clip->x1);
+		if (a <= b)
+			(Span)(w, a, b, h, color, userdata);
 	}
 };
 #endif
 
-static int TriangleCheck(window *w,int x1,int y1,int x2,int y2,int x3,int y3){
-	int width = io_GetWidth(w);
-	int height = io_GetHeight(w);
-	if (x1 < 0 && x2 < 0 && x3 < 0)
+#ifdef _HALFSPACE
+/* https://fgiesen.wordpress.com/2013/02/10/optimizing-the-basic-rasterizer/
+ * E(x,y) = a*x + b*y + c is >= 0 inside of the edge. Corners come in
+ * 28.4 subpixels and every pixel is tested in its centre. The bounding box
+ * (cut by the scissor) is walked by 8x8 blocks: a block outside of any edge is skipped, a
+ * block inside of all edges is taken without per-pixel tests. Rows of
+ * a convex triangle are single intervals, so the coverage of a block
+ * row is collected into [lo,hi] per row and given away as spans*/
+#define BLOCK 8
+typedef struct {
+	int64_t a;
+	int64_t b;
+	int64_t c;
+} edge_fn;
+
+/*edge of 28.4 corners stepped in whole pixels: E(x,y) is the value in
+  the centre of pixel (x,y)*/
+static void EdgeSetup(fixed xa, fixed ya, fixed xb, fixed yb, edge_fn *e){
+	int64_t a = ya - yb;
+	int64_t b = xb - xa;
+	e->a = a * (1 << N);
+	e->b = b * (1 << N);
+	e->c = (int64_t)xa * yb - (int64_t)xb * ya + (a + b) * (1 << (N-1));
+	if(!(a > 0 || (a == 0 && b > 0)))
+		e->c--;	/*top-left fill rule: only left and top edges own pixels*/
+};
+
+#define EDGE_AT(e,x,y) ((e).a * (x) + (e).b * (y) + (e).c)
+/*value in the block corner where edge function is the smallest*/
+#define EDGE_MIN(e,x,y) EDGE_AT(e, (x) + (((e).a < 0)?(BLOCK-1):0),\
+				  (y) + (((e).b < 0)?(BLOCK-1):0))
+#define EDGE_MAX(e,x,y) EDGE_AT(e, (x) + (((e).a > 0)?(BLOCK-1):0),\
+				  (y) + (((e).b > 0)?(BLOCK-1):0))
+
+static void Rasterize(window *w, /*draws triangle, corners in 28.4*/
+		   fixed x1,fixed y1,fixed x2,fixed y2,fixed x3,fixed y3,
+		   scissor *clip, SpanPlotter Span, int color, void *userdata) {
+	int64_t area = (int64_t)(x2 - x1) * (y3 - y1) -
+		       (int64_t)(x3 - x1) * (y2 - y1);
+	if(area == 0)
+		return;
+	if(area < 0){ swap_xy(&x2, &x3); swap_xy(&y2, &y3); }
+	edge_fn e[3];
+	EdgeSetup(x1, y1, x2, y2, &e[0]);
+	EdgeSetup(x2, y2, x3, y3, &e[1]);
+	EdgeSetup(x3, y3, x1, y1, &e[2]);
+	/*pixels with the centre in the box of the corners*/
+	int min_x = MAX(FIRST_PIXEL(MIN(MIN(x1, x2), x3)), clip->x0);
+	int min_y = MAX(FIRST_PIXEL(MIN(MIN(y1, y2), y3)), clip->y0);
+	int max_x = MIN(LAST_PIXEL(MAX(MAX(x1, x2), x3)), clip->x1);
+	int max_y = MIN(LAST_PIXEL(MAX(MAX(y1, y2), y3)), clip->y1);
+	if(min_x > max_x || min_y > max_y)
+		return;
+	int lo[BLOCK], hi[BLOCK];
+	/*blocks are aligned to the 8x8 grid, pixels stay in the box*/
+	for(int by = min_y & ~(BLOCK-1); by <= max_y; by += BLOCK){
+		int r_beg = MAX(min_y - by, 0);
+		int rows = MIN(BLOCK, max_y - by + 1);
+		for(int r = r_beg; r < rows; r++){
+			lo[r] = max_x + 1; hi[r] = -1;
+		};
+		for(int bx = min_x & ~(BLOCK-1); bx <= max_x; bx += BLOCK){
+			int full = 1;
+			int skip = 0;
+			for(int k = 0; k < 3; k++){
+				if(EDGE_MAX(e[k], bx, by) < 0)
+					skip = 1;
+				if(EDGE_MIN(e[k], bx, by) < 0)
+					full = 0;
+			};
+			if(skip)
+				continue;
+			int x_beg = MAX(bx, min_x);
+			int x_end = MIN(bx + BLOCK - 1, max_x);
+			if(full){
+				for(int r = r_beg; r < rows; r++){
+					lo[r] = MIN(lo[r], x_beg);
+					hi[r] = x_end;
+				};
+				continue;
+			};
+			for(int r = r_beg; r < rows; r++){
+				int64_t w0 = EDGE_AT(e[0], x_beg, by + r);
+				int64_t w1 = EDGE_AT(e[1], x_beg, by + r);
+				int64_t w2 = EDGE_AT(e[2], x_beg, by + r);
+				for(int x = x_beg; x <= x_end; x++){
+					if((w0 | w1 | w2) >= 0){
+						lo[r] = MIN(lo[r], x);
+						hi[r] = x;
+					}else if(hi[r] >= x_beg){
+						break; /*row left the triangle*/
+					};
+					w0 += e[0].a; w1 += e[1].a; w2 += e[2].a;
+				};
+			};
+		};
+		for(int r = r_beg; r < rows; r++){
+			if(lo[r] <= hi[r])
+				(Span)(w, lo[r], hi[r], by + r,
+							color, userdata);
+		};
+	};
+};
+#endif
+
+/*guard band: a triangle with every corner closer than GUARD_BAND pixels
+  to the scissor is rasterized as it is, its spans are cut by the scissor.
+  Edge and scanline steps of the rasterizers stay in integer range there*/
+#define GUARD_BAND (1 << 16)
+static int GuardBand(scissor *clip,int x1,int y1,int x2,int y2,int x3,int y3){
+	return MIN(MIN(x1, x2), x3) >= clip->x0 - GUARD_BAND &&
+	       MAX(MAX(x1, x2), x3) <= clip->x1 + GUARD_BAND &&
+	       MIN(MIN(y1, y2), y3) >= clip->y0 - GUARD_BAND &&
+	       MAX(MAX(y1, y2), y3) <= clip->y1 + GUARD_BAND;
+};
+
+/*Rasterize() with corners in whole pixels*/
+static void RasterizePixels(window *w,
+		   int x1,int y1,int x2,int y2,int x3,int y3, scissor *clip,
+		   SpanPlotter Span, int color, void *userdata){
+#ifdef _HALFSPACE
+	Rasterize(w,PIXEL_CENTER(x1),PIXEL_CENTER(y1),PIXEL_CENTER(x2),
+		PIXEL_CENTER(y2),PIXEL_CENTER(x3),PIXEL_CENTER(y3),
+		clip,Span,color,userdata);
+#else
+	Rasterize(w,x1,y1,x2,y2,x3,y3,clip,Span,color,userdata);
+#endif
+};
+
+static int TriangleCheck(scissor *clip,int x1,int y1,int x2,int y2,int x3,int y3){
+	if (x1 < clip->x0 && x2 < clip->x0 && x3 < clip->x0)
 		return 1; /*Left Border*/
-	if (x1 >= width && x2 >= width && x3 >= width)
+	if (x1 > clip->x1 && x2 > clip->x1 && x3 > clip->x1)
 		return 1; /*Right Border*/
-	if (y1 < 0 && y2 < 0 && y3 < 0)
+	if (y1 < clip->y0 && y2 < clip->y0 && y3 < clip->y0)
 		return 1; /*Up Border*/
-	if (y1 >= height && y2 >= height && y3 >= height)
+	if (y1 > clip->y1 && y2 > clip->y1 && y3 > clip->y1)
 		return 1; /*Down Border*/
 	return 0;
 };
@@ -538,11 +714,12 @@ static int InsideEdge(int x, int y, enum edge e, int b){
 static void SutherlandHodgman(window *w,
 			int x0, int y0,
 			int x1, int y1,
-			int x2, int y2,
-			Plotter Plot, int color, void *userdata){
-	int max_x = io_GetWidth(w) ; int max_y = io_GetHeight(w) ;
+			int x2, int y2, scissor *clip,
+			SpanPlotter Span, int color, void *userdata){
 	NEW_POLYGON(out) = {{x0,y0},{x1,y1},{x2,y2},{0,0},{0,0},{0,0},{0,0}};
-	int boards[4] = {0, max_x - 1, 0, max_y};
+	/*one pixel over the right and bottom of the scissor: those edges
+	  of the pieces own no pixels*/
+	int boards[4] = {clip->x0, clip->x1 + 1, clip->y0, clip->y1 + 1};
 	for (enum edge e = left; e <= top; e++) {
 		NEW_POLYGON(inp); 
 		ASSIGMENT_POLYGON(inp,out);
@@ -566,11 +743,11 @@ static void SutherlandHodgman(window *w,
 		};
 	};/*End. Next draw output triangels*/
 	for (int p = 1; p < COUNT(out) - 1 ; p++) {
-		Rasterize(w,
+		RasterizePixels(w,
 			  GET_X(out,0),GET_Y(out,0),
 			  GET_X(out,p),GET_Y(out,p),
-			  GET_X(out,p+1),GET_Y(out,p+1),
-			  Plot,color,userdata);
+			  GET_X(out,p+1),GET_Y(out,p+1), clip,
+			  Span,color,userdata);
 	}
 }
 
@@ -597,6 +774,25 @@ static int ClipFill(window *w, int *x0, int *y0, int *x1, int *y1){
 	return 0;
 }
 
+/*count pixels of row y from x: straight into the locked canvas fb, or by
+  io_SetSpan for backends without one*/
+#define FILL_CHUNK 64
+static void FillSpan(window *w, framebuffer *fb,
+			int x, int y, int count, int color){
+	if(fb->base != NULL && fb->format == IO_FORMAT_ARGB32
+			&& x + count <= fb->width && y < fb->height){
+		int *row = fb->base + y * fb->stride + x;
+		for(int i = 0; i < count; i++)
+			row[i] = color;
+		return;
+	};
+	int chunk[FILL_CHUNK];
+	for(int i = 0; i < MIN(count, FILL_CHUNK); i++)
+		chunk[i] = color;
+	for(int i = 0; i < count; i += FILL_CHUNK)
+		io_SetSpan(w, x + i, y, MIN(count - i, FILL_CHUNK), chunk);
+};
+
 static int ClipRectangle(window *w, int *x0, int *y0, int *x1, int *y1){
 	int max_x = io_GetWidth(w); int max_y = io_GetHeight(w);
 	if(*x1 < 0 || *y1 < 0){
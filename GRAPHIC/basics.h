@@ -44,15 +44,33 @@
 #define TRANSPARENT(color) (((color) & 0xFF000000) == 0x00000000)
 
 typedef void(*Plotter)(window *w,int x,int y, int color, void *userdata);
+typedef void(*SpanPlotter)(window *w,int x0,int x1,int y,int color,void *userdata);
+typedef struct {
+	int x0; int y0;	//inclusive, inside of the canvas
+	int x1; int y1;
+} scissor;
 
 typedef struct font_t font;
 
+/*28.4 subpixel coordinates (see algebra.h): pixel (x,y) is the square
+  [x,x+1)x[y,y+1) and it is covered if its centre is inside*/
+#define PIXEL_CENTER(x) (INT_TO_FIXED(x) + (1 << (N-1)))
+#define FIRST_PIXEL(f) FIXED_TO_INT((f) + (1 << (N-1)) - 1) //centre >= f
+#define LAST_PIXEL(f) FIXED_TO_INT((f) - (1 << (N-1)))	   //centre <= f
+
 /* 1.PRIMITIVES-FUNCS */
 void DrawPixel(window *w, int x, int y, int color);
 void DrawAlphaPixel(window *w, int x, int y, int color);
 void DrawLine(window *w, int x0, int y0, int x1, int y1, int color);
 void DrawTriangle( window *w, int x1,int y1,int x2,int y2,int x3,int y3,
 		    Plotter Plot, int color, void *userdata);
+void DrawTriangleSpans(window *w, int x1,int y1,int x2,int y2,int x3,int y3,
+		    SpanPlotter Span, int color, void *userdata);
+void DrawTriangleScissor(window *w, int x1,int y1,int x2,int y2,int x3,int y3,
+		    scissor *clip, SpanPlotter Span, int color, void *userdata);
+void DrawTriangleSubpixel(window *w, fixed x1, fixed y1, fixed x2, fixed y2,
+		fixed x3, fixed y3, scissor *clip, SpanPlotter Span,
+		int color, void *userdata);
 void DrawImage(window *w, int x0, int y0, int *image);
 void DrawFill(window *w, int x0, int y0, int x1, int y1, int color);
 void DrawRectangle(window *w, int x0, int y0, int x1, int y1, int color);
@@ -111,6 +129,34 @@ you can create custom plotter-function as "Plotter" profile (see above):
 	DrawTriangle(w,300,300,100,100,220,500,RandomColorPlot,NULL,NULL);
 	DrawTriangle(w,300,300,100,100,220,500,TexturePlot,intensy,&texture);
 	DrawTriangle(w,300,300,100,100,220,500,GradientPlot,NULL,&colors_data);
+
+if per-pixel calls are too slow, take whole horizontal lines (x0..x1
+inclusive, on row y) with a "SpanPlotter" instead:
+
+	DrawTriangleSpans(w,300,300,100,100,220,500,DepthSpan,color,&zdata);
+
+DrawTriangleScissor() gives away only the spans inside of the clip rect
+(one screen tile, for example):
+
+	scissor tile = {64, 0, 127, 63};
+	DrawTriangleScissor(w,300,300,100,100,220,500,&tile,DepthSpan,color,&zdata);
+
+a triangle is cut by the polygon clipper only if it reaches farther
+than a guard band of 65536 pixels out of the clip rect, others are
+drawn as they are and only their spans are cut.
+
+DrawTriangleSubpixel() takes the corners in 28.4 fixed point (16 steps
+per pixel), so small or slowly moving triangles do not snap to the pixel
+grid:
+
+	DrawTriangleSubpixel(w,4808,4808,1608,1608,3528,8008,&tile,DepthSpan,color,&zdata);
+
+compiled with -D_HALFSPACE the triangle is covered by edge functions in
+8x8 blocks: a pixel is drawn if its centre is inside, centres right on
+an edge go to the triangle on the left or top of it (top-left fill
+rule), so triangles sharing an edge cover every pixel exactly once.
+Otherwise it is drawn by scanlines, subpixel corners are rounded to
+whole pixels.
 	
 	*/
 
@@ -35,25 +35,819 @@
 #include <string.h>
 #include <math.h>
 #include <float.h>
+#include <pthread.h>
 #include "render3d.h"
 
 #define SUN (vector){0,0,1}
 #define MISSED_TEXTURE_COLOR 0xFFFFC0CB
+#define DEFAULT_NEAR 1
 #define DEFAULT_FAR 10000
 #define SHADOW 0.4
 #define REFLEX 0.2
+#define TILE 64			/*screen tile of the binning renderer*/
+#define VERTEX_CHUNK 4096	/*corners per vertex job*/
 
-/*plotters (call-back funcs for DrawTriangle)*/
-static void DepthFilter(window *w, int x, int y, int color, void *data);
-static void DepthPlot(window *w, int x, int y, int color, void *user_data);
-static void TexturePlot(window *w, int x, int y, int color, void *user_data);
+/*sampler-ready texture: ARGB texels of the image and its mipmaps in
+  one block, kept in TGAimage->sampler. Texels go in 4x4 tiles (a cache
+  line), so neighbouring pixels fetch from the same line*/
+#define TEXTURE_LEVELS 16
+typedef struct {
+	int cols;		//texel (col,row) is get_pixel(level,col,row)
+	int rows;
+	int pow2;		//both sides are powers of two: wrap by mask
+	int tiles;		//tiles in a row of tiles
+	uint32_t *texel;
+} texture_level;
+
+typedef struct {
+	int levels;
+	texture_level level[TEXTURE_LEVELS];
+} sampler;
+
+#define TEXEL_INDEX(l,col,row) \
+	(((((row) >> 2) * (l)->tiles + ((col) >> 2)) << 4) +\
+					(((row) & 3) << 2) + ((col) & 3))
+
+/*per-triangle attribute planes, userdata of span-funcs. Everything
+  is set up once per triangle, span-funcs only add dx per pixel*/
+typedef struct {
+	void *zbase;		//depth of (x,y) is SLICE_ROW(st,type,y)[x]
+	int zstride;
+	int zformat;
+	int zx;			//origin of the zbuffer slice
+	int zy;
+	hiz_level *hiz;		//blocks written by spans get dirty
+	sampler *sampler;	//NULL - untextured
+	texture_level *texture;	//mip level of the triangle
+	float th;		//texture columns
+	float tw;		//texture rows
+	uint32_t *vbuffer;	//RenderVisibility, indexed by screen x,y
+	int vstride;
+	int *frame;		//locked canvas, NULL - io_SetPixel/io_SetSpan
+	int fstride;
+	plane z;		//depth
+	plane q;		//1/w
+	plane col;		//texture column/w
+	plane row;		//texture row/w
+	plane light;		//intensity/w (flat: intensity)
+} triangle_setup;
+
+typedef struct draw_call_t draw_call;
+/*per-triangle part of a render mode, returns color for the span-func*/
+typedef int (*TriangleSetup)(draw_call *d, uint32_t *c,
+			vector s0, vector s1, vector s2, triangle_setup *st);
+
+struct draw_call_t { /*one Render* call, shared by all workers*/
+	window *w;
+	camera *cam;
+	wavefront_mesh *m;
+	TriangleSetup Setup;
+	SpanPlotter Span;
+	int color;
+	TGAimage *texture;
+	int cull;		//drop back faces
+	int lit;		//vertex stage: light corners too
+	int max_depth;		//RenderZBuffer
+	int next;		//next job item (tile or corner chunk)
+	framebuffer fb;		//canvas locked by DrawMesh/RenderVisibility
+};
+
+/*worker pool of the camera (camera->threads - 1 workers + caller)*/
+typedef struct {
+	int count;
+	int size;
+	uint32_t *tri;
+} tile_bin;
+
+struct render_pool_t {
+	int count;		//worker threads
+	pthread_t *worker;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t finish;
+	void (*Job)(draw_call *d);
+	draw_call *d;
+	int round;		//incremented by every job
+	int busy;		//workers still in the job
+	int quit;
+	int tiles_x;
+	int tiles_y;
+	int bins;		//allocated bins (tiles_x * tiles_y or more)
+	tile_bin *bin;		//triangles overlapping every tile
+};
+
+/*depth storage of the cameras: zbuffer, hiz and the id buffer. It is
+  sized by buckets of TARGET_STEP pixels and shared by all cameras of
+  one bucket and format, so resizes inside a bucket allocate nothing.
+  Released targets wait in the pool (up to TARGET_POOL of them) for the
+  next camera of their bucket. Depths belong to the last camera that
+  cleaned the zbuffer, other cameras start with an empty one*/
+#define TARGET_STEP 64
+#define TARGET_POOL 4
+struct render_target_t {
+	int w;			//bucket in pixels
+	int h;
+	int format;
+	int users;		//cameras bound, 0 - in the pool
+	camera *owner;
+	depth_buffer zbuffer;
+	hiz_level hiz[HIZ_LEVELS];
+	uint32_t *vbuffer;	//RenderVisibility, NULL until then
+	render_target *next;
+};
+static render_target *targets = NULL;	//bound ones and the pool
+
+/*texture coordinates of triangle c, scaled to texels and divided by w
+  (q - 1/w of the corners)*/
+#define TEXTURE_SETUP(st,u,v,s0,s1,s2,q) \
+		AttributeSetup(s0, s1, s2, (u)[0] * (st).th * (q)[0],\
+			(u)[1] * (st).th * (q)[1],\
+			(u)[2] * (st).th * (q)[2], &((st).col));\
+		AttributeSetup(s0, s1, s2, (v)[0] * (st).tw * (q)[0],\
+			(v)[1] * (st).tw * (q)[1],\
+			(v)[2] * (st).tw * (q)[2], &((st).row))
+
+/*texel (col,row) of level l, the texture repeats outside of it*/
+static inline int Texel(texture_level *l, int col, int row){
+	if(l->pow2){
+		col &= l->cols - 1;
+		row &= l->rows - 1;
+	}else if((unsigned)col >= (unsigned)l->cols ||
+		 (unsigned)row >= (unsigned)l->rows){
+		col %= l->cols;
+		row %= l->rows;
+		col += (col < 0)?l->cols:0;
+		row += (row < 0)?l->rows:0;
+	};
+	return l->texel[TEXEL_INDEX(l, col, row)];
+};
+
+/*row y of the zbuffer slice of st, indexed by screen x*/
+#define SLICE_ROW(st,T,y) \
+	((T *)(st)->zbase + ((y) - (st)->zy) * (st)->zstride - (st)->zx)
+
+/*marks blocks of span x0..x1 on row y in every level of hiz*/
+#define HIZ_DIRTY(hiz,x0,x1,y) \
+	for(int l_ = 0; l_ < HIZ_LEVELS; l_++){\
+		hiz_level *hl_ = &((hiz)[l_]);\
+		unsigned char *row_ = hl_->dirty + ((y) / hl_->size) * hl_->w;\
+		for(int b_ = (x0) / hl_->size; b_ <= (x1) / hl_->size; b_++)\
+			row_[b_] = TRUE;\
+	}
+
+/*-------------------------------SPAN KERNELS-------------------------------*/
+
+/*span-funcs go by chunks of SPAN_LANES pixels through kernels picked
+  at run time (KernelsInit): SSE2 or AVX2 on x86, plain C elsewhere or
+  with _NO_SIMD. Every kernel computes a pixel of a run the same way,
+  v + (o + k) * dv in float, so all of them draw the same picture*/
+#define SPAN_LANES 8
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) &&\
+						!defined(_NO_SIMD)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+typedef struct {	/*values at the start of a run and their steps*/
+	float z, dz;
+	float i, di;
+	float col, dcol;
+	float row, drow;
+} span_run;
+
+/*depth test of pixels o..o+n-1 of run r (n <= SPAN_LANES), depth
+  points to pixel o. Stores passed depths, returns their bit mask*/
+typedef unsigned (*DepthKernel)(void *depth, const span_run *r, int o, int n);
+/*colors of pixels o..o+SPAN_LANES-1 of run r, lit by its intensity*/
+typedef void (*ShadeKernel)(triangle_setup *st, const span_run *r, int o,
+							int color, int *out);
+/*writes pixel k of out (k < m <= SPAN_LANES) into row[k] if bit k of
+  pass is set*/
+typedef void (*StoreKernel)(int *row, const int *out, unsigned pass, int m);
+
+static unsigned Depth32(void *depth, const span_run *r, int o, int n){
+	fixed *d = (fixed *)depth;
+	unsigned pass = 0;
+	for(int k = 0; k < n; k++){
+		fixed z = (fixed)(r->z + (float)(o + k) * r->dz);
+		if(z <= d[k]){
+			d[k] = z;
+			pass |= 1u << k;
+		};
+	};
+	return pass;
+};
+
+static unsigned Depth16(void *depth, const span_run *r, int o, int n){
+	uint16_t *d = (uint16_t *)depth;
+	unsigned pass = 0;
+	for(int k = 0; k < n; k++){
+		int z = (int)(r->z + (float)(o + k) * r->dz);
+		if(z <= d[k]){
+			d[k] = (uint16_t)MAX(z, 0);
+			pass |= 1u << k;
+		};
+	};
+	return pass;
+};
+
+static unsigned DepthF(void *depth, const span_run *r, int o, int n){
+	float *d = (float *)depth;
+	unsigned pass = 0;
+	for(int k = 0; k < n; k++){
+		float z = r->z + (float)(o + k) * r->dz;
+		if(z >= d[k]){
+			d[k] = z;
+			pass |= 1u << k;
+		};
+	};
+	return pass;
+};
+
+static void ShadeColor(triangle_setup *st, const span_run *r, int o,
+							int color, int *out){
+	for(int k = 0; k < SPAN_LANES; k++)
+		out[k] = AdjustIntensity(color, r->i + (float)(o + k) * r->di);
+};
+
+static void ShadeTexel(triangle_setup *st, const span_run *r, int o,
+							int color, int *out){
+	for(int k = 0; k < SPAN_LANES; k++){
+		float col = r->col + (float)(o + k) * r->dcol;
+		float row = r->row + (float)(o + k) * r->drow;
+		out[k] = AdjustIntensity(Texel(st->texture, (int)col, (int)row),
+					r->i + (float)(o + k) * r->di);
+	};
+};
+
+static void StoreOpaque(int *row, const int *out, unsigned pass, int m){
+	for(int k = 0; k < m; k++)
+		if(pass & (1u << k))
+			row[k] = out[k];
+};
+
+/*transparent pixels are skipped, the rest go through BlendAlpha*/
+static void StoreAlpha(int *row, const int *out, unsigned pass, int m){
+	for(int k = 0; k < m; k++){
+		int px = out[k];
+		if(!(pass & (1u << k)) || TRANSPARENT(px))
+			continue;
+		if(ALPHA(px))
+			BlendAlpha(row[k], &px);
+		row[k] = px;
+	};
+};
+
+#ifdef SIMD_X86
+/*AdjustIntensity of 4 colors*/
+__attribute__((target("sse2")))
+static inline __m128i Intensity4(__m128i c, __m128 i){
+	i = _mm_andnot_ps(_mm_set1_ps(-0.0f), i);
+	__m128i ff = _mm_set1_epi32(0xFF);
+	__m128i r = _mm_and_si128(_mm_srli_epi32(c, 16), ff);
+	__m128i g = _mm_and_si128(_mm_srli_epi32(c, 8), ff);
+	__m128i b = _mm_and_si128(c, ff);
+	r = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(r), i));
+	g = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(g), i));
+	b = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(b), i));
+	c = _mm_and_si128(c, _mm_set1_epi32(0xFF000000));
+	return _mm_or_si128(_mm_or_si128(c, _mm_slli_epi32(r, 16)),
+				_mm_or_si128(_mm_slli_epi32(g, 8), b));
+};
+
+/*lanes o+k of v + (o + k) * dv*/
+__attribute__((target("sse2")))
+static inline __m128 Lanes4(float v, float dv, int o){
+	__m128 k = _mm_add_ps(_mm_set1_ps((float)o), _mm_setr_ps(0, 1, 2, 3));
+	return _mm_add_ps(_mm_set1_ps(v), _mm_mul_ps(k, _mm_set1_ps(dv)));
+};
+
+__attribute__((target("sse2")))
+static unsigned Depth32SSE2(void *depth, const span_run *r, int o, int n){
+	if(n < SPAN_LANES)
+		return Depth32(depth, r, o, n);
+	unsigned pass = 0;
+	for(int h = 0; h < SPAN_LANES; h += 4){
+		__m128i *d = (__m128i *)((fixed *)depth + h);
+		__m128i z = _mm_cvttps_epi32(Lanes4(r->z, r->dz, o + h));
+		__m128i old = _mm_loadu_si128(d);
+		__m128i fail = _mm_cmpgt_epi32(z, old);
+		_mm_storeu_si128(d, _mm_or_si128(_mm_and_si128(fail, old),
+					_mm_andnot_si128(fail, z)));
+		pass |= (~_mm_movemask_ps(_mm_castsi128_ps(fail)) & 0xF) << h;
+	};
+	return pass;
+};
+
+/*16 bit depths are widened to 32 bit lanes, the result is packed back
+  with unsigned saturation (SSE2 packs signed: shifted by 0x8000)*/
+__attribute__((target("sse2")))
+static unsigned Depth16SSE2(void *depth, const span_run *r, int o, int n){
+	if(n < SPAN_LANES)
+		return Depth16(depth, r, o, n);
+	__m128i *d = (__m128i *)depth;
+	__m128i old = _mm_loadu_si128(d);
+	__m128i lo = _mm_unpacklo_epi16(old, _mm_setzero_si128());
+	__m128i hi = _mm_unpackhi_epi16(old, _mm_setzero_si128());
+	__m128i zlo = _mm_cvttps_epi32(Lanes4(r->z, r->dz, o));
+	__m128i zhi = _mm_cvttps_epi32(Lanes4(r->z, r->dz, o + 4));
+	__m128i flo = _mm_cmpgt_epi32(zlo, lo);
+	__m128i fhi = _mm_cmpgt_epi32(zhi, hi);
+	__m128i bias = _mm_set1_epi32(0x8000);
+	lo = _mm_or_si128(_mm_and_si128(flo, lo), _mm_andnot_si128(flo, zlo));
+	hi = _mm_or_si128(_mm_and_si128(fhi, hi), _mm_andnot_si128(fhi, zhi));
+	_mm_storeu_si128(d, _mm_xor_si128(_mm_packs_epi32(
+		_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias)),
+						_mm_set1_epi16(0x8000)));
+	return ~(_mm_movemask_ps(_mm_castsi128_ps(flo)) |
+		 _mm_movemask_ps(_mm_castsi128_ps(fhi)) << 4) & 0xFF;
+};
+
+__attribute__((target("sse2")))
+static unsigned DepthFSSE2(void *depth, const span_run *r, int o, int n){
+	if(n < SPAN_LANES)
+		return DepthF(depth, r, o, n);
+	unsigned pass = 0;
+	for(int h = 0; h < SPAN_LANES; h += 4){
+		float *d = (float *)depth + h;
+		__m128 z = Lanes4(r->z, r->dz, o + h);
+		__m128 old = _mm_loadu_ps(d);
+		__m128 ok = _mm_cmpge_ps(z, old);
+		_mm_storeu_ps(d, _mm_or_ps(_mm_and_ps(ok, z),
+					_mm_andnot_ps(ok, old)));
+		pass |= _mm_movemask_ps(ok) << h;
+	};
+	return pass;
+};
+
+__attribute__((target("sse2")))
+static void ShadeColorSSE2(triangle_setup *st, const span_run *r, int o,
+							int color, int *out){
+	for(int h = 0; h < SPAN_LANES; h += 4)
+		_mm_storeu_si128((__m128i *)(out + h), Intensity4(
+			_mm_set1_epi32(color), Lanes4(r->i, r->di, o + h)));
+};
+
+/*SSE2 has no gather: coordinates in vectors, fetches one by one*/
+__attribute__((target("sse2")))
+static void ShadeTexelSSE2(triangle_setup *st, const span_run *r, int o,
+							int color, int *out){
+	int col[4], row[4], texel[4];
+	for(int h = 0; h < SPAN_LANES; h += 4){
+		_mm_storeu_si128((__m128i *)col,
+			_mm_cvttps_epi32(Lanes4(r->col, r->dcol, o + h)));
+		_mm_storeu_si128((__m128i *)row,
+			_mm_cvttps_epi32(Lanes4(r->row, r->drow, o + h)));
+		for(int k = 0; k < 4; k++)
+			texel[k] = Texel(st->texture, col[k], row[k]);
+		_mm_storeu_si128((__m128i *)(out + h), Intensity4(
+			_mm_loadu_si128((__m128i *)texel),
+			Lanes4(r->i, r->di, o + h)));
+	};
+};
+
+/*bits h..h+3 of pass as lane masks*/
+__attribute__((target("sse2")))
+static inline __m128i Mask4(unsigned pass, int h){
+	__m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+	return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(pass >> h), bit),
+									bit);
+};
+
+/*BlendAlpha of 4 colors over bg. An opaque color stays as it is:
+  alpha is exactly 1 then*/
+__attribute__((target("sse2")))
+static inline __m128i Blend4(__m128i c, __m128i bg){
+	__m128i ff = _mm_set1_epi32(0xFF);
+	__m128 alpha = _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(c, 24)),
+						_mm_set1_ps(255.0f));
+	__m128 rest = _mm_sub_ps(_mm_set1_ps(1.0f), alpha);
+	__m128i res = _mm_set1_epi32(0xFF000000);
+	for(int s = 0; s <= 16; s += 8){
+		__m128 f = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, s), ff));
+		__m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(bg, s), ff));
+		__m128i v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, alpha),
+						_mm_mul_ps(b, rest)));
+		res = _mm_or_si128(res, _mm_slli_epi32(v, s));
+	};
+	return res;
+};
+
+__attribute__((target("sse2")))
+static void StoreOpaqueSSE2(int *row, const int *out, unsigned pass, int m){
+	if(m < SPAN_LANES){
+		StoreOpaque(row, out, pass, m);
+		return;
+	};
+	for(int h = 0; h < SPAN_LANES; h += 4){
+		__m128i *d = (__m128i *)(row + h);
+		__m128i mask = Mask4(pass, h);
+		__m128i c = _mm_loadu_si128((const __m128i *)(out + h));
+		_mm_storeu_si128(d, _mm_or_si128(_mm_and_si128(mask, c),
+				_mm_andnot_si128(mask, _mm_loadu_si128(d))));
+	};
+};
+
+__attribute__((target("sse2")))
+static void StoreAlphaSSE2(int *row, const int *out, unsigned pass, int m){
+	if(m < SPAN_LANES){
+		StoreAlpha(row, out, pass, m);
+		return;
+	};
+	for(int h = 0; h < SPAN_LANES; h += 4){
+		__m128i *d = (__m128i *)(row + h);
+		__m128i c = _mm_loadu_si128((const __m128i *)(out + h));
+		__m128i old = _mm_loadu_si128(d);
+		__m128i clear = _mm_cmpeq_epi32(_mm_srli_epi32(c, 24),
+							_mm_setzero_si128());
+		__m128i mask = _mm_andnot_si128(clear, Mask4(pass, h));
+		_mm_storeu_si128(d, _mm_or_si128(_mm_and_si128(mask,
+			Blend4(c, old)), _mm_andnot_si128(mask, old)));
+	};
+};
+
+/*AdjustIntensity of 8 colors*/
+__attribute__((target("avx2")))
+static inline __m256i Intensity8(__m256i c, __m256 i){
+	i = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), i);
+	__m256i ff = _mm256_set1_epi32(0xFF);
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(c, 16), ff);
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(c, 8), ff);
+	__m256i b = _mm256_and_si256(c, ff);
+	r = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(r), i));
+	g = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(g), i));
+	b = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(b), i));
+	c = _mm256_and_si256(c, _mm256_set1_epi32(0xFF000000));
+	return _mm256_or_si256(_mm256_or_si256(c, _mm256_slli_epi32(r, 16)),
+				_mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+};
+
+__attribute__((target("avx2")))
+static inline __m256 Lanes8(float v, float dv, int o){
+	__m256 k = _mm256_add_ps(_mm256_set1_ps((float)o),
+				_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+	return _mm256_add_ps(_mm256_set1_ps(v), _mm256_mul_ps(k, _mm256_set1_ps(dv)));
+};
+
+__attribute__((target("avx2")))
+static unsigned Depth32AVX2(void *depth, const span_run *r, int o, int n){
+	if(n < SPAN_LANES)
+		return Depth32(depth, r, o, n);
+	__m256i *d = (__m256i *)depth;
+	__m256i z = _mm256_cvttps_epi32(Lanes8(r->z, r->dz, o));
+	__m256i old = _mm256_loadu_si256(d);
+	__m256i fail = _mm256_cmpgt_epi32(z, old);
+	_mm256_storeu_si256(d, _mm256_blendv_epi8(z, old, fail));
+	return ~_mm256_movemask_ps(_mm256_castsi256_ps(fail)) & 0xFF;
+};
+
+__attribute__((target("avx2")))
+static unsigned Depth16AVX2(void *depth, const span_run *r, int o, int n){
+	if(n < SPAN_LANES)
+		return Depth16(depth, r, o, n);
+	__m128i *d = (__m128i *)depth;
+	__m256i z = _mm256_cvttps_epi32(Lanes8(r->z, r->dz, o));
+	__m256i old = _mm256_cvtepu16_epi32(_mm_loadu_si128(d));
+	__m256i fail = _mm256_cmpgt_epi32(z, old);
+	__m256i res = _mm256_blendv_epi8(z, old, fail);
+	/*packs within 128 bit halves: quadwords 0 and 2 hold the result*/
+	res = _mm256_permute4x64_epi64(_mm256_packus_epi32(res, res), 0x08);
+	_mm_storeu_si128(d, _mm256_castsi256_si128(res));
+	return ~_mm256_movemask_ps(_mm256_castsi256_ps(fail)) & 0xFF;
+};
+
+__attribute__((target("avx2")))
+static unsigned DepthFAVX2(void *depth, const span_run *r, int o, int n){
+	if(n < SPAN_LANES)
+		return DepthF(depth, r, o, n);
+	float *d = (float *)depth;
+	__m256 z = Lanes8(r->z, r->dz, o);
+	__m256 old = _mm256_loadu_ps(d);
+	__m256 ok = _mm256_cmp_ps(z, old, _CMP_GE_OQ);
+	_mm256_storeu_ps(d, _mm256_blendv_ps(old, z, ok));
+	return _mm256_movemask_ps(ok);
+};
+
+__attribute__((target("avx2")))
+static void ShadeColorAVX2(triangle_setup *st, const span_run *r, int o,
+							int color, int *out){
+	_mm256_storeu_si256((__m256i *)out, Intensity8(_mm256_set1_epi32(color),
+						Lanes8(r->i, r->di, o)));
+};
+
+/*pass as lane masks*/
+__attribute__((target("avx2")))
+static inline __m256i Mask8(unsigned pass){
+	__m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(pass),
+								bit), bit);
+};
+
+/*Blend4 of 8 colors*/
+__attribute__((target("avx2")))
+static inline __m256i Blend8(__m256i c, __m256i bg){
+	__m256i ff = _mm256_set1_epi32(0xFF);
+	__m256 alpha = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(c, 24)),
+						_mm256_set1_ps(255.0f));
+	__m256 rest = _mm256_sub_ps(_mm256_set1_ps(1.0f), alpha);
+	__m256i res = _mm256_set1_epi32(0xFF000000);
+	for(int s = 0; s <= 16; s += 8){
+		__m256 f = _mm256_cvtepi32_ps(_mm256_and_si256(
+					_mm256_srli_epi32(c, s), ff));
+		__m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(
+					_mm256_srli_epi32(bg, s), ff));
+		__m256i v = _mm256_cvttps_epi32(_mm256_add_ps(
+			_mm256_mul_ps(f, alpha), _mm256_mul_ps(b, rest)));
+		res = _mm256_or_si256(res, _mm256_slli_epi32(v, s));
+	};
+	return res;
+};
+
+__attribute__((target("avx2")))
+static void StoreOpaqueAVX2(int *row, const int *out, unsigned pass, int m){
+	if(m < SPAN_LANES){
+		StoreOpaque(row, out, pass, m);
+		return;
+	};
+	_mm256_maskstore_epi32(row, Mask8(pass),
+				_mm256_loadu_si256((const __m256i *)out));
+};
+
+__attribute__((target("avx2")))
+static void StoreAlphaAVX2(int *row, const int *out, unsigned pass, int m){
+	if(m < SPAN_LANES){
+		StoreAlpha(row, out, pass, m);
+		return;
+	};
+	__m256i c = _mm256_loadu_si256((const __m256i *)out);
+	__m256i clear = _mm256_cmpeq_epi32(_mm256_srli_epi32(c, 24),
+						_mm256_setzero_si256());
+	__m256i old = _mm256_loadu_si256((const __m256i *)row);
+	_mm256_maskstore_epi32(row, _mm256_andnot_si256(clear, Mask8(pass)),
+							Blend8(c, old));
+};
+
+__attribute__((target("avx2")))
+static void ShadeTexelAVX2(triangle_setup *st, const span_run *r, int o,
+							int color, int *out){
+	texture_level *l = st->texture;
+	__m256i col = _mm256_cvttps_epi32(Lanes8(r->col, r->dcol, o));
+	__m256i row = _mm256_cvttps_epi32(Lanes8(r->row, r->drow, o));
+	if(l->pow2){
+		col = _mm256_and_si256(col, _mm256_set1_epi32(l->cols - 1));
+		row = _mm256_and_si256(row, _mm256_set1_epi32(l->rows - 1));
+	}else{
+		__m256i out_col = _mm256_or_si256(
+			_mm256_cmpgt_epi32(_mm256_setzero_si256(), col),
+			_mm256_cmpgt_epi32(col, _mm256_set1_epi32(l->cols - 1)));
+		__m256i out_row = _mm256_or_si256(
+			_mm256_cmpgt_epi32(_mm256_setzero_si256(), row),
+			_mm256_cmpgt_epi32(row, _mm256_set1_epi32(l->rows - 1)));
+		if(!_mm256_testz_si256(out_col, out_col) ||
+		   !_mm256_testz_si256(out_row, out_row)){
+			ShadeTexel(st, r, o, color, out);	/*wraps*/
+			return;
+		};
+	};
+	__m256i three = _mm256_set1_epi32(3);
+	__m256i tile = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(
+			row, 2), _mm256_set1_epi32(l->tiles)), _mm256_srli_epi32(col, 2));
+	__m256i index = _mm256_add_epi32(_mm256_slli_epi32(tile, 4),
+		_mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(row, three), 2),
+					_mm256_and_si256(col, three)));
+	__m256i texel = _mm256_i32gather_epi32((const int *)l->texel, index, 4);
+	_mm256_storeu_si256((__m256i *)out, Intensity8(texel,
+						Lanes8(r->i, r->di, o)));
+};
+#endif
+
+static struct {
+	DepthKernel Depth[3];	//fixed (both formats), 16 bit, float
+	ShadeKernel Color;
+	ShadeKernel Texel;
+	StoreKernel Opaque;	//pixel writers into the locked canvas
+	StoreKernel Alpha;
+} Kernels = {{Depth32, Depth16, DepthF}, ShadeColor, ShadeTexel,
+						StoreOpaque, StoreAlpha};
+
+/*picks the widest kernels the CPU runs, once: workers of other cameras
+  read the table*/
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static void KernelsInit(void){
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		Kernels.Depth[0] = Depth32AVX2;
+		Kernels.Depth[1] = Depth16AVX2;
+		Kernels.Depth[2] = DepthFAVX2;
+		Kernels.Color = ShadeColorAVX2;
+		Kernels.Texel = ShadeTexelAVX2;
+		Kernels.Opaque = StoreOpaqueAVX2;
+		Kernels.Alpha = StoreAlphaAVX2;
+	}else if(__builtin_cpu_supports("sse2")){
+		Kernels.Depth[0] = Depth32SSE2;
+		Kernels.Depth[1] = Depth16SSE2;
+		Kernels.Depth[2] = DepthFSSE2;
+		Kernels.Color = ShadeColorSSE2;
+		Kernels.Texel = ShadeTexelSSE2;
+		Kernels.Opaque = StoreOpaqueSSE2;
+		Kernels.Alpha = StoreAlphaSSE2;
+	};
+#endif
+};
+
+/*span-funcs (call-back funcs for DrawTriangleSpans). Every variant is
+  generated by SPAN_SHADER with constant TEXTURED/LIGHT, a pixel
+  writer PUT and a depth storage D, so the compiler leaves a loop over
+  kernel chunks without mode branches. Spans are always on the canvas.
+  Depth goes in float like the planes, so 24.8 keeps its fraction only
+  up to the 24 bits of the mantissa (a distance of 65536).*/
+enum {LIGHT_NONE, LIGHT_FLAT, LIGHT_GOURAUD};
+/*pixel writers: m pixels of out from x, pixel k only if bit k of pass is
+  set. row is line y of the locked canvas, NULL - through io_* calls*/
+static inline void PutNone(triangle_setup *st, window *w, int *row,
+		int x, int y, unsigned pass, int m, const int *out){
+};
+
+static inline void PutId(triangle_setup *st, window *w, int *row,
+		int x, int y, unsigned pass, int m, const int *out){
+	uint32_t *id = st->vbuffer + y * st->vstride + x;
+	for(int k = 0; k < m; k++)
+		if(pass & (1u << k))
+			id[k] = out[k];
+};
+
+static inline void PutOpaque(triangle_setup *st, window *w, int *row,
+		int x, int y, unsigned pass, int m, const int *out){
+	if(row != NULL){
+		Kernels.Opaque(row + x, out, pass, m);
+	}else if(pass == (1u << m) - 1){
+		io_SetSpan(w, x, y, m, out);
+	}else{
+		for(int k = 0; k < m; k++)
+			if(pass & (1u << k))
+				io_SetPixel(w, x + k, y, out[k]);
+	};
+};
+
+static inline void PutAlpha(triangle_setup *st, window *w, int *row,
+		int x, int y, unsigned pass, int m, const int *out){
+	if(row != NULL){
+		Kernels.Alpha(row + x, out, pass, m);
+		return;
+	};
+	for(int k = 0; k < m; k++){
+		int px = out[k];
+		if(!(pass & (1u << k)) || TRANSPARENT(px))
+			continue;
+		if(ALPHA(px))
+			BlendAlpha(io_GetPixel(w, x + k, y), &px);
+		io_SetPixel(w, x + k, y, px);
+	};
+};
+/*depth storages: type and Kernels.Depth[]*/
+#define DEPTH_T_32 fixed
+#define DEPTH_K_32 0
+#define DEPTH_T_16 uint16_t
+#define DEPTH_K_16 1
+#define DEPTH_T_F float
+#define DEPTH_K_F 2
+#define SPAN_TEXEL(st,col,row) Texel((st)->texture, (int)(col), (int)(row))
+/*spans go in SUBSPAN pixel runs aligned on the screen, and the planes are
+  evaluated at the ends of every run, so a span cut at a tile edge gives
+  the same pixels. Perspective-correct attributes: the planes hold
+  attribute/w and 1/w, the reciprocal is taken at the run ends and
+  attributes go linearly in between*/
+#define SUBSPAN 16
+#define SPAN_SHADER(NAME, TEXTURED, LIGHT, PUT, D) \
+static void NAME##D(window *w, int x0, int x1, int y, int color, void *user_data){\
+	triangle_setup *st = (triangle_setup *)user_data;\
+	DEPTH_T_##D *depth = SLICE_ROW(st, DEPTH_T_##D, y);\
+	DepthKernel Depth = Kernels.Depth[DEPTH_K_##D];\
+	ShadeKernel Shade = (TEXTURED)?Kernels.Texel:Kernels.Color;\
+	int warp = (TEXTURED) || LIGHT == LIGHT_GOURAUD;\
+	span_run r = {0, st->z.dx, 1, 0, 0, 0, 0, 0};\
+	if(LIGHT == LIGHT_FLAT)\
+		r.i = PLANE_AT(st->light, x0, y);\
+	if(warp){\
+		float rw = 1 / PLANE_AT(st->q, x0, y);\
+		if(LIGHT == LIGHT_GOURAUD)\
+			r.i = PLANE_AT(st->light, x0, y) * rw;\
+		if(TEXTURED){\
+			r.col = PLANE_AT(st->col, x0, y) * rw;\
+			r.row = PLANE_AT(st->row, x0, y) * rw;\
+		};\
+	};\
+	int *row = (st->frame == NULL)?NULL:st->frame + y * st->fstride;\
+	int wrote = FALSE;\
+	int out[SPAN_LANES];\
+	if(LIGHT == LIGHT_NONE)\
+		for(int k = 0; k < SPAN_LANES; k++)\
+			out[k] = color;\
+	for(int x = x0; x <= x1;){\
+		int end = MIN((x & ~(SUBSPAN - 1)) + SUBSPAN, x1 + 1);\
+		int n = end - x;\
+		float i1 = r.i, col1 = r.col, row1 = r.row;\
+		r.z = PLANE_AT(st->z, x, y);\
+		if(warp){\
+			float rw = 1 / PLANE_AT(st->q, end, y);\
+			if(LIGHT == LIGHT_GOURAUD){\
+				i1 = PLANE_AT(st->light, end, y) * rw;\
+				r.di = (i1 - r.i) / n;\
+			};\
+			if(TEXTURED){\
+				col1 = PLANE_AT(st->col, end, y) * rw;\
+				row1 = PLANE_AT(st->row, end, y) * rw;\
+				r.dcol = (col1 - r.col) / n;\
+				r.drow = (row1 - r.row) / n;\
+			};\
+		};\
+		for(int o = 0; o < n; o += SPAN_LANES){\
+			int m = MIN(SPAN_LANES, n - o);\
+			unsigned pass = Depth(depth + x + o, &r, o, m);\
+			if(pass == 0)\
+				continue;\
+			wrote = TRUE;\
+			if(LIGHT != LIGHT_NONE)\
+				Shade(st, &r, o, color, out);\
+			PUT(st, w, row, x + o, y, pass, m, out);\
+		};\
+		r.i = i1; r.col = col1; r.row = row1;\
+		x = end;\
+	};\
+	if(wrote)\
+		HIZ_DIRTY(st->hiz, x0, x1, y);\
+}
+
+#define SPAN_SHADERS(D) \
+SPAN_SHADER(DepthFilter,	 FALSE, LIGHT_NONE,	PutNone,	D)\
+SPAN_SHADER(FlatSpan,		 FALSE, LIGHT_NONE,	PutOpaque,	D)\
+SPAN_SHADER(TextureSpan,	 TRUE,  LIGHT_FLAT,	PutOpaque,	D)\
+SPAN_SHADER(GouraudSpan,	 FALSE, LIGHT_GOURAUD,	PutOpaque,	D)\
+SPAN_SHADER(GouraudAlphaSpan,	 FALSE, LIGHT_GOURAUD,	PutAlpha,	D)\
+SPAN_SHADER(GouraudTextureSpan, TRUE,  LIGHT_GOURAUD,	PutAlpha,	D)\
+SPAN_SHADER(VisibilitySpan,	 FALSE, LIGHT_NONE,	PutId,		D)
+
+SPAN_SHADERS(32)
+SPAN_SHADERS(16)
+SPAN_SHADERS(F)
+
+/*span-funcs of every depth format, SPAN(cam,kind) picks one per draw*/
+enum {SPAN_DEPTH, SPAN_FLAT, SPAN_TEXTURE, SPAN_GOURAUD, SPAN_GOURAUD_ALPHA,
+			SPAN_GOURAUD_TEXTURE, SPAN_VISIBILITY, SPAN_KINDS};
+#define SPAN_ROW(D) {DepthFilter##D, FlatSpan##D, TextureSpan##D,\
+		GouraudSpan##D, GouraudAlphaSpan##D, GouraudTextureSpan##D,\
+		VisibilitySpan##D}
+static const SpanPlotter Spans[DEPTH_FORMATS][SPAN_KINDS] = {
+	SPAN_ROW(32),	//DEPTH_FIXED_28_4
+	SPAN_ROW(32),	//DEPTH_FIXED_24_8
+	SPAN_ROW(16),	//DEPTH_16
+	SPAN_ROW(F)	//DEPTH_FLOAT_REVERSED
+};
+#define SPAN(cam,kind) (Spans[(cam)->zbuffer.format][kind])
+
+/*vertex stage*/
+static float Illuminate(vector n);
+static int ProcessVertices(camera *cam, wavefront_mesh *m, int lit);
+static int FrustumCull(camera *cam, wavefront_mesh *m);
+static inline int BackFace(vertex_cache *vc, uint32_t *c);
+/*walks triangles t of the clusters that passed FrustumCull*/
+#define FOR_VISIBLE_TRIANGLES(vc,m,t) \
+	for(int k_ = 0; k_ < (m)->clusters; k_++) if((vc)->cluster[k_])\
+		for(int t = k_ * MESH_CLUSTER;\
+		    t < MIN((k_ + 1) * MESH_CLUSTER, (m)->triangles); t++)
+/*walks triangles cut by the near plane, they are numbered after the mesh*/
+#define FOR_CLIPPED_TRIANGLES(vc,m,t) \
+	for(int t = (m)->triangles; t < (m)->triangles + (vc)->triangles; t++)
+#define TRIANGLE_CORNERS(vc,m,t) (((t) < (m)->triangles)?\
+		&((m)->index[3 * (t)]):&((vc)->index[3 * ((t) - (m)->triangles)]))
+/*binning renderer*/
+static render_pool *UsePool(camera *cam);
+static void PoolRun(render_pool *p, void (*Job)(draw_call *), draw_call *d);
+static void FreePool(render_pool *p);
+static void PoolTiles(render_pool *p, camera *cam);
+static void LockCanvas(draw_call *d);
+static void DrawMesh(draw_call *d);
+static void InitSetup(draw_call *d, triangle_setup *st);
+/*render targets*/
+static void BindTarget(camera *cam, int width, int height, int format);
+static void BindWindow(window *w, camera *cam);
+static render_target *AcquireTarget(int width, int height, int format);
+static void ReleaseTarget(render_target *t, camera *cam);
 /*ZBufer utilities*/
-static fixed **ZBufferInit(int width, int height);
+static void ZBufferInit(depth_buffer *zb, int width, int height, int format);
 static void FillZBuffer(window *w, camera *cam, wavefront_obj *obj);
 static void CleanZBuffer(camera *cam);
-static void ZBufferFree(fixed **ZBuffer);
+static void ZBufferFree(depth_buffer *zb);
+/*hierarchical z*/
+static void HiZInit(hiz_level *hiz, int width, int height);
+static inline float DepthValue(camera *cam, float z);
+static inline fixed DepthKey(int format, float z);
+static void HiZRefresh(hiz_level *hiz, triangle_setup *st, scissor *area);
+static int HiZOccluded(hiz_level *hiz, scissor *area, fixed z);
 
 camera *InitCamera(window *w,int x0,int y0,int z0,int x1,int y1,int z1,int fov){
+	pthread_once(&kernels_once, KernelsInit);
 	camera *res = malloc(sizeof(camera));
 	res->pos[X] = (float)(x0);
 	res->pos[Y] = (float)(y0);
@@ -62,28 +856,52 @@ camera *InitCamera(window *w,int x0,int y0,int z0,int x1,int y1,int z1,int fov){
 	res->target[Y] = (float)(y1);
 	res->target[Z] = (float)(z1);
 	res->fov = (float)(fov);
+	res->near = DEFAULT_NEAR;
 	res->far = DEFAULT_FAR;
-	res->w = io_GetWidth(w);
-	res->h = io_GetHeight(w);
-	res->hw = res->w/2;
-	res->hh = res->h/2;
 	vec_sub(res->target, res->pos, res->dir);
 	vec_normalize(res->dir);
 	vec_cross(SUN, res->dir, res->y_aix);
 	vec_normalize(res->y_aix);
 	vec_cross(res->dir, res->y_aix, res->z_aix);
 	vec_normalize(res->z_aix);
-	res->zbuffer = ZBufferInit(res->w, res->h);
+	res->storage = NULL;
+	BindTarget(res, io_GetWidth(w), io_GetHeight(w), DEPTH_FIXED_28_4);
+	memset(&(res->cache), 0, sizeof(vertex_cache));
 	res->buf_refill_required = TRUE;
+	res->depth_prepass = FALSE;
+	res->perspective_correct = TRUE;
+	res->threads = 1;
+	res->pool = NULL;
 	res->Capture = PerspectiveProjection;
 	return res;
 };
 
 void FreeCamera(camera *cam){
-	ZBufferFree(cam->zbuffer);
+	FreePool(cam->pool);
+	ReleaseTarget(cam->storage, cam);
+	free(cam->cache.point);
+	free(cam->cache.x);
+	free(cam->cache.y);
+	free(cam->cache.z);
+	free(cam->cache.rw);
+	free(cam->cache.clip);
+	free(cam->cache.light);
+	free(cam->cache.u);
+	free(cam->cache.v);
+	free(cam->cache.index);
+	free(cam->cache.source);
+	free(cam->cache.cluster);
 	free(cam);
 }
 
+/*replaces the zbuffer by an empty one of format (DEPTH_*)*/
+void SetDepthFormat(camera *cam, int format){
+	if(format < 0 || format >= DEPTH_FORMATS ||
+	   format == cam->zbuffer.format)
+		return;
+	BindTarget(cam, cam->w, cam->h, format);
+};
+
 void MoveCamera(camera *cam, vector new_pos, vector new_target){
 	cam->buf_refill_required = TRUE;
 	CleanZBuffer(cam);
@@ -105,396 +923,1287 @@ void MoveCamera(camera *cam, vector new_pos, vector new_target){
 	vec_normalize(cam->z_aix);
 }
 
-int PerspectiveProjection(vector p, camera *cam, int *x, int *y, fixed *z){
+/*screen coordinate in 28.4, far off-screen corners are pulled in so
+  the edge functions of the rasterizer stay in 64 bits*/
+#define SUBPIXEL_LIMIT (1 << 27)
+static inline fixed Subpixel(float v){
+	v = v * (1 << N);
+	if(!(v > -SUBPIXEL_LIMIT))
+		return -SUBPIXEL_LIMIT;
+	if(v > SUBPIXEL_LIMIT)
+		return SUBPIXEL_LIMIT;
+	return (fixed)floorf(v + 0.5f);
+};
+
+int PerspectiveProjection(vector p, camera *cam, fixed *x, fixed *y, float *z){
 	vector p_c = {  p[X] - cam->pos[X],
 			p[Y] - cam->pos[Y],
 			p[Z] - cam->pos[Z]	};
 	float x_cam = vec_dot(p_c, cam->y_aix);
 	float y_cam = vec_dot(p_c, cam->z_aix);
 	float z_cam = vec_dot(p_c, cam->dir);
-	if(z_cam <= 0 || z_cam >= cam->far) {
-		return 1;
-	}
-	*x = (int)((x_cam * cam->fov) / z_cam) + cam->hw;
-	*y = cam->hh - (int)((y_cam * cam->fov) / z_cam);
-	*z = FLOAT_TO_FIXED(z_cam);
+	if(z_cam < cam->near)
+		return CLIP_NEAR;
+	if(z_cam >= cam->far)
+		return CLIP_FAR;
+	*x = Subpixel((x_cam * cam->fov) / z_cam + cam->hw);
+	*y = Subpixel(cam->hh - (y_cam * cam->fov) / z_cam);
+	*z = z_cam;
 	return 0;
 }
 
-int OrthographicProjection(vector p, camera *cam, int *x, int *y, fixed *z){
+int OrthographicProjection(vector p, camera *cam, fixed *x, fixed *y, float *z){
 	vector p_c = {  p[X] - cam->pos[X],
 			p[Y] - cam->pos[Y],
 			p[Z] - cam->pos[Z]	};
 	float x_cam = vec_dot(p_c, cam->y_aix);
 	float y_cam = vec_dot(p_c, cam->z_aix);
 	float z_cam = vec_dot(p_c, cam->dir);
-	if(z_cam <= 0 || z_cam >= cam->far) {
-		return 1;
-	}
-	*x = (int)(x_cam) + cam->hw;
-	*y = cam->hh - (int)(y_cam);
-	*z = FLOAT_TO_FIXED(z_cam);
+	if(z_cam < cam->near)
+		return CLIP_NEAR;
+	if(z_cam >= cam->far)
+		return CLIP_FAR;
+	*x = Subpixel(x_cam + cam->hw);
+	*y = Subpixel(cam->hh - y_cam);
+	*z = z_cam;
 	return 0;
 };
 
-void RenderWireframe(window *w, camera *cam, wavefront_obj *obj, int color){
-	int i = 0;
-	while(FACE(obj,i) != NULL){
-		vector p0, p1;
-		fixed z0,z1;
-		int x0,y0,x1,y1;
-		polygon *prv = FACE(obj,i);
-		polygon *cur = FACE(obj,i)->next;
-		while(cur != NULL){
-			COPY_POINT(obj,prv->v,p0);
-			COPY_POINT(obj,cur->v,p1);
-			if(cam->Capture(p0, cam, &x0, &y0, &z0) ||
-			   cam->Capture(p1, cam, &x1, &y1, &z1)){
-			   	prv = cur;
-				cur = cur->next;
+/*projects positions [from,to) of the mesh into cam->cache*/
+static void PositionRange(camera *cam, wavefront_mesh *m, int from, int to){
+	vertex_cache *vc = &(cam->cache);
+	vector p;
+	float z;
+	int warp = cam->perspective_correct && cam->Capture == PerspectiveProjection;
+	for(int i = from; i < to; i++){
+		projected *pt = &(vc->point[i]);
+		COPY_MESH_POSITION(m,i,p);
+		pt->clip = cam->Capture(p, cam, &(pt->x), &(pt->y), &z);
+		if(pt->clip)
+			continue;
+		pt->z = DepthValue(cam, z);
+		pt->rw = (warp)?(1 / z):1;
+	};
+};
+
+/*corners [from,to) of the mesh take their projected position (and are
+  lit) in cam->cache*/
+static void VertexRange(camera *cam, wavefront_mesh *m, int lit,
+							int from, int to){
+	vertex_cache *vc = &(cam->cache);
+	vector n;
+	for(int c = from; c < to; c++){
+		projected *pt = &(vc->point[m->pos[c]]);
+		vc->x[c] = pt->x;
+		vc->y[c] = pt->y;
+		vc->z[c] = pt->z;
+		vc->rw[c] = pt->rw;
+		vc->clip[c] = pt->clip;
+	};
+	if(!lit || m->nx == NULL)
+		return;
+	for(int c = from; c < to; c++){
+		COPY_MESH_NORMAL(m,c,n);
+		vc->light[c] = Illuminate(n);
+	};
+};
+
+/*job: position chunks of VERTEX_CHUNK*/
+static void PositionJob(draw_call *d){
+	int from;
+	while((from = VERTEX_CHUNK * __atomic_fetch_add(&(d->next), 1,
+				__ATOMIC_RELAXED)) < d->m->positions){
+		PositionRange(d->cam, d->m, from,
+				MIN(from + VERTEX_CHUNK, d->m->positions));
+	};
+};
+
+/*job: corner chunks of VERTEX_CHUNK, after PositionJob*/
+static void VertexJob(draw_call *d){
+	int from;
+	while((from = VERTEX_CHUNK * __atomic_fetch_add(&(d->next), 1,
+				__ATOMIC_RELAXED)) < d->m->count){
+		VertexRange(d->cam, d->m, d->lit, from,
+				MIN(from + VERTEX_CHUNK, d->m->count));
+	};
+};
+
+/*frustum planes of the camera in world space: dot(n,p) + d >= 0 inside*/
+static int FrustumSetup(camera *cam, float fr[6][4]){
+	float side[4][3];	/*y_aix, z_aix, dir factors*/
+	if(cam->Capture == PerspectiveProjection){
+		float s[4][3] = {{ cam->fov, 0, cam->hw}, {-cam->fov, 0, cam->hw},
+				 {0,  cam->fov, cam->hh}, {0, -cam->fov, cam->hh}};
+		memcpy(side, s, sizeof(s));
+	}else if(cam->Capture == OrthographicProjection){
+		float s[4][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}};
+		memcpy(side, s, sizeof(s));
+	}else{
+		return FALSE; /*unknown projection, nothing is culled*/
+	};
+	for(int i = 0; i < 4; i++){
+		vector n;
+		for(int a = X; a <= Z; a++){
+			n[a] = side[i][0] * cam->y_aix[a] +
+			       side[i][1] * cam->z_aix[a] +
+			       side[i][2] * cam->dir[a];
+		};
+		vec_normalize(n);
+		fr[i][0] = n[X]; fr[i][1] = n[Y]; fr[i][2] = n[Z];
+		fr[i][3] = -vec_dot(n, cam->pos);
+	};
+	if(cam->Capture == OrthographicProjection){
+		fr[0][3] += cam->hw; fr[1][3] += cam->hw;
+		fr[2][3] += cam->hh; fr[3][3] += cam->hh;
+	};
+	for(int a = X; a <= Z; a++){
+		fr[4][a] = cam->dir[a];		/*near*/
+		fr[5][a] = -cam->dir[a];	/*far*/
+	};
+	fr[4][3] = -cam->near - vec_dot(cam->dir, cam->pos);
+	fr[5][3] = cam->far + vec_dot(cam->dir, cam->pos);
+	return TRUE;
+};
+
+/*bounds are completely behind one of the planes*/
+static int BoundsOutside(float fr[6][4], mesh_bounds *b){
+	for(int i = 0; i < 6; i++){
+		float *n = fr[i];
+		if(n[X]*b->center[X] + n[Y]*b->center[Y] + n[Z]*b->center[Z]
+						+ n[3] < -b->radius)
+			return TRUE;
+		/*AABB corner that is the farthest along n*/
+		float px = (n[X] >= 0)?(b->max[X]):(b->min[X]);
+		float py = (n[Y] >= 0)?(b->max[Y]):(b->min[Y]);
+		float pz = (n[Z] >= 0)?(b->max[Z]):(b->min[Z]);
+		if(n[X]*px + n[Y]*py + n[Z]*pz + n[3] < 0)
+			return TRUE;
+	};
+	return FALSE;
+};
+
+/*marks clusters of the mesh in the frustum, FALSE - whole mesh is out*/
+static int FrustumCull(camera *cam, wavefront_mesh *m){
+	vertex_cache *vc = &(cam->cache);
+	if(vc->clusters < m->clusters){
+		vc->clusters = m->clusters;
+		vc->cluster = realloc(vc->cluster, vc->clusters);
+	};
+	float fr[6][4];
+	if(!FrustumSetup(cam, fr)){
+		memset(vc->cluster, TRUE, m->clusters);
+		return TRUE;
+	};
+	if(BoundsOutside(fr, &(m->bounds)))
+		return FALSE;
+	for(int k = 0; k < m->clusters; k++)
+		vc->cluster[k] = !BoundsOutside(fr, &(m->cluster[k]));
+	return TRUE;
+};
+
+/*room for count corners in the vertex cache*/
+static void CacheReserve(vertex_cache *vc, int count){
+	if(vc->size >= count)
+		return;
+	vc->size = MAX(count, vc->size + vc->size / 2);
+	vc->x = realloc(vc->x, vc->size * sizeof(fixed));
+	vc->y = realloc(vc->y, vc->size * sizeof(fixed));
+	vc->z = realloc(vc->z, vc->size * sizeof(float));
+	vc->rw = realloc(vc->rw, vc->size * sizeof(float));
+	vc->clip = realloc(vc->clip, vc->size * sizeof(unsigned char));
+	vc->light = realloc(vc->light, vc->size * sizeof(float));
+};
+
+static float CameraDepth(camera *cam, wavefront_mesh *m, uint32_t c){
+	vector p;
+	COPY_MESH_POINT(m,c,p);
+	vec_sub(p, cam->pos, p);
+	return vec_dot(p, cam->dir);
+};
+
+/*the near plane is cut a bit in front of cam->near, so rounding never
+  puts a clip corner behind it*/
+#define NEAR_SLACK 1.001f
+/*clip corner on edge a-b of the mesh, a - in front of the near plane
+  (depth za), b - behind it. Returns its index in the cache, -1 - the
+  projection refused it*/
+static int ClipCorner(camera *cam, wavefront_mesh *m, int lit,
+				uint32_t a, uint32_t b, float za, float zb){
+	vertex_cache *vc = &(cam->cache);
+	if(!(zb < cam->near))
+		return -1;	/*refused by a custom projection, not by depth*/
+	float t = MAX((za - cam->near * NEAR_SLACK) / (za - zb), 0);
+	vector pa, pb, p;
+	COPY_MESH_POINT(m,a,pa);
+	COPY_MESH_POINT(m,b,pb);
+	for(int i = X; i <= Z; i++)
+		p[i] = pa[i] + (pb[i] - pa[i]) * t;
+	CacheReserve(vc, vc->corners + vc->extra + 1);
+	if(vc->extra == vc->extra_size){
+		vc->extra_size = (vc->extra_size)?(vc->extra_size * 2):(64);
+		vc->u = realloc(vc->u, vc->extra_size * sizeof(float));
+		vc->v = realloc(vc->v, vc->extra_size * sizeof(float));
+	};
+	int c = vc->corners + vc->extra;
+	float z;
+	if(cam->Capture(p, cam, &(vc->x[c]), &(vc->y[c]), &z) != 0)
+		return -1;
+	vc->clip[c] = 0;
+	vc->z[c] = DepthValue(cam, z);
+	vc->rw[c] = (cam->perspective_correct &&
+			cam->Capture == PerspectiveProjection)?(1 / z):1;
+	if(lit && m->nx != NULL)
+		vc->light[c] = vc->light[a] + (vc->light[b] - vc->light[a]) * t;
+	if(m->u != NULL){
+		vc->u[vc->extra] = m->u[a] + (m->u[b] - m->u[a]) * t;
+		vc->v[vc->extra] = m->v[a] + (m->v[b] - m->v[a]) * t;
+	};
+	vc->extra++;
+	return c;
+};
+
+/*cuts visible triangles with corners behind the near plane in camera
+  space (Sutherland-Hodgman by one plane). What is left in front of it
+  is fanned into vc->index: 1 triangle, or 2 if it was a quad*/
+static void NearClip(camera *cam, wavefront_mesh *m, int lit){
+	vertex_cache *vc = &(cam->cache);
+	vc->corners = m->count;
+	vc->extra = 0;
+	vc->triangles = 0;
+	FOR_VISIBLE_TRIANGLES(vc,m,t){
+		uint32_t *c = &(m->index[3*t]);
+		unsigned char *clip = vc->clip;
+		/*corners beyond far or all behind near: nothing to draw*/
+		if((clip[c[0]] | clip[c[1]] | clip[c[2]]) != CLIP_NEAR ||
+		   (clip[c[0]] & clip[c[1]] & clip[c[2]]))
+			continue;
+		float z[3];
+		for(int k = 0; k < 3; k++)
+			z[k] = CameraDepth(cam, m, c[k]);
+		int poly[4], n = 0, lost = FALSE;
+		for(int k = 0; k < 3; k++){
+			int a = k, b = (k + 1) % 3;
+			if(!vc->clip[c[a]])
+				poly[n++] = c[a];
+			if(!vc->clip[c[a]] == !vc->clip[c[b]])
 				continue;
+			/*from the visible corner, so both triangles of an edge
+			  get the same clip corner*/
+			int p = (vc->clip[c[a]])?
+				ClipCorner(cam, m, lit, c[b], c[a], z[b], z[a]):
+				ClipCorner(cam, m, lit, c[a], c[b], z[a], z[b]);
+			lost |= p < 0;
+			poly[n++] = p;
+		};
+		if(lost)
+			continue;
+		for(int k = 1; k + 1 < n; k++){
+			if(vc->triangles == vc->tri_size){
+				vc->tri_size = (vc->tri_size)?(vc->tri_size * 2):(64);
+				vc->index = realloc(vc->index,
+					3 * vc->tri_size * sizeof(uint32_t));
+				vc->source = realloc(vc->source,
+					vc->tri_size * sizeof(uint32_t));
 			};
-			DrawLine(w,x0,y0,x1,y1,color);
-			prv = cur;
-			cur = cur->next;
-			if(cur == NULL){
-				cur = FACE(obj,i);
-				COPY_POINT(obj,prv->v,p0);
-				COPY_POINT(obj,cur->v,p1);
-				if(cam->Capture(p0, cam, &x0, &y0, &z0) ||
-				   cam->Capture(p1, cam, &x1, &y1, &z1))
-					break;
-				DrawLine(w,x0,y0,x1,y1,color);
-				break;
-			};
+			uint32_t *tri = &(vc->index[3 * vc->triangles]);
+			tri[0] = poly[0]; tri[1] = poly[k]; tri[2] = poly[k + 1];
+			vc->source[vc->triangles++] = t;
 		};
-		i++;
 	};
 };
 
-/*plotter-func*/
-static void DepthPlot(window *w, int x, int y, int color, void *user_data){
-	void **data = (void **)user_data;
-	fixed z0 = *((int *)(data[0]));
-	fixed z1 = *((int *)(data[1]));
-	fixed z2 = *((int *)(data[2]));
-	fixed z = div((z0+z1+z2),3);
-	fixed **zbuffer = ((fixed **)(data[3]));
-	if(z <= zbuffer[x][y]){
-		io_SetPixel(w,x,y,color);
+/*projects and lights every corner of the mesh into cam->cache,
+  FALSE - the mesh is out of the frustum, nothing to draw*/
+static int ProcessVertices(camera *cam, wavefront_mesh *m, int lit){
+	vertex_cache *vc = &(cam->cache);
+	if(!FrustumCull(cam, m))
+		return FALSE;
+	CacheReserve(vc, m->count);
+	if(vc->points < m->positions){
+		vc->points = MAX(m->positions, vc->points + vc->points / 2);
+		vc->point = realloc(vc->point, vc->points * sizeof(projected));
+	};
+	render_pool *pool = UsePool(cam);
+	if(pool == NULL){
+		PositionRange(cam, m, 0, m->positions);
+		VertexRange(cam, m, lit, 0, m->count);
+	}else{
+		draw_call d = {.cam = cam, .m = m, .lit = lit, .next = 0};
+		PoolRun(pool, PositionJob, &d);
+		d.next = 0;
+		PoolRun(pool, VertexJob, &d);
+	};
+	NearClip(cam, m, lit);
+	return TRUE;
+};
+
+static float Illuminate(vector n){
+	float intensy = vec_dot(SUN,n);
+	intensy = (1-intensy)*SHADOW + intensy;
+	if(intensy <= 0){
+		intensy = -intensy *REFLEX;
 	}
+	return intensy;
+};
+
+void RenderWireframe(window *w, camera *cam, wavefront_obj *obj, int color){
+	BindWindow(w, cam);
+	wavefront_mesh *m = obj->mesh;
+	vertex_cache *vc = &(cam->cache);
+	if(!ProcessVertices(cam, m, FALSE))
+		return;
+	FOR_VISIBLE_TRIANGLES(vc,m,t){
+		uint32_t *c = &(m->index[3*t]);
+		/*back faces go as in the other renderers. A triangle cut
+		  by the near plane has no winding on the screen: drawn*/
+		if(!obj->two_sided && !(vc->clip[c[0]] | vc->clip[c[1]] |
+					vc->clip[c[2]]) && BackFace(vc, c))
+			continue;
+		for(int e = 0; e < 3; e++){
+			int a = c[e];
+			int b = c[(e+1)%3];
+			if(!(m->edges[t] & (1 << e)))
+				continue;
+			if(vc->clip[a] && !vc->clip[b]){
+				int swap = a; a = b; b = swap;
+			};
+			if(vc->clip[a] || (vc->clip[b] && vc->clip[b] != CLIP_NEAR))
+				continue;
+			if(vc->clip[b])	/*ends on the near plane*/
+				b = ClipCorner(cam, m, FALSE, a, b,
+					CameraDepth(cam, m, a), CameraDepth(cam, m, b));
+			if(b < 0)
+				continue;
+			DrawLine(w,FIXED_TO_INT(vc->x[a]),FIXED_TO_INT(vc->y[a]),
+				FIXED_TO_INT(vc->x[b]),FIXED_TO_INT(vc->y[b]),color);
+		};
+	};
+};
+
+/*takes screen corners of triangle c from the vertex cache, depth in [Z]
+  returns 1 if any of them was clipped. x,y are shifted by half a pixel:
+  attribute planes are taken in the pixel centres, PLANE_AT(pl,x,y)*/
+#define SCREEN(f) ((float)((f) - (1 << (N-1))) * (1.0f / (1 << N)))
+static inline int Gather(vertex_cache *vc, uint32_t *c,
+				vector s0, vector s1, vector s2){
+	if(vc->clip[c[0]] | vc->clip[c[1]] | vc->clip[c[2]])
+		return 1;
+	s0[X] = SCREEN(vc->x[c[0]]); s0[Y] = SCREEN(vc->y[c[0]]);
+	s1[X] = SCREEN(vc->x[c[1]]); s1[Y] = SCREEN(vc->y[c[1]]);
+	s2[X] = SCREEN(vc->x[c[2]]); s2[Y] = SCREEN(vc->y[c[2]]);
+	s0[Z] = vc->z[c[0]]; s1[Z] = vc->z[c[1]]; s2[Z] = vc->z[c[2]];
+	return 0;
+};
+
+#define DRAW_TRIANGLE(d,vc,c,clip,color,st) \
+	DrawTriangleSubpixel((d)->w,(vc)->x[(c)[0]],(vc)->y[(c)[0]],\
+		(vc)->x[(c)[1]],(vc)->y[(c)[1]],(vc)->x[(c)[2]],(vc)->y[(c)[2]],\
+		(clip),(d)->Span,(color),(st))
+
+/*triangle c is turned away from the camera (or has no area on screen).
+  Front faces of the mesh go counter-clockwise on the screen*/
+static inline int BackFace(vertex_cache *vc, uint32_t *c){
+	int64_t area = (int64_t)(vc->x[c[1]] - vc->x[c[0]]) *
+				(vc->y[c[2]] - vc->y[c[0]]) -
+		       (int64_t)(vc->x[c[2]] - vc->x[c[0]]) *
+				(vc->y[c[1]] - vc->y[c[0]]);
+	return area >= 0;
+};
+
+/*sampler of image, made (with mipmaps) on the first call*/
+static sampler *UseSampler(TGAimage *image){
+	if(image->sampler != NULL)
+		return image->sampler;
+	make_mipmaps(image);
+	int levels = 0, texels = 0;
+	for(TGAimage *l = image; l != NULL && levels < TEXTURE_LEVELS;
+						l = l->mipmap, levels++)
+		texels += (get_width(l) + 3) / 4 * ((get_height(l) + 3) / 4) * 16;
+	sampler *smp = malloc(sizeof(sampler) + ZBUFFER_ALIGN +
+						texels * sizeof(uint32_t));
+	uint32_t *texel = (uint32_t *)(((uintptr_t)(smp + 1) + ZBUFFER_ALIGN - 1)
+					& ~(uintptr_t)(ZBUFFER_ALIGN - 1));
+	smp->levels = levels;
+	TGAimage *img = image;
+	for(int k = 0; k < levels; k++, img = img->mipmap){
+		texture_level *l = &(smp->level[k]);
+		l->cols = get_width(img);
+		l->rows = get_height(img);
+		l->pow2 = !(l->cols & (l->cols - 1)) && !(l->rows & (l->rows - 1));
+		l->tiles = (l->cols + 3) / 4;
+		l->texel = texel;
+		texel += l->tiles * ((l->rows + 3) / 4) * 16;
+		for(int row = 0; row < l->rows; row++)
+			for(int col = 0; col < l->cols; col++)
+				l->texel[TEXEL_INDEX(l, col, row)] =
+						get_pixel(img, col, row);
+	};
+	image->sampler = smp;
+	return smp;
+};
+
+/*triangle-setup*/
+static int SetupDepth(draw_call *d, uint32_t *c,
+			vector s0, vector s1, vector s2, triangle_setup *st){
+	PlaneSetup(s0, s1, s2, &(st->z));
+	return d->color;
+};
+
+/*picks the mip level of the texture for triangle c: halves the texture
+  while the triangle covers more than 2x2 texels per pixel*/
+static void MipSetup(float *u, float *v,
+		vector s0, vector s1, vector s2, triangle_setup *st){
+	sampler *smp = st->sampler;
+	float u1 = (u[1] - u[0]) * smp->level[0].cols;
+	float v1 = (v[1] - v[0]) * smp->level[0].rows;
+	float u2 = (u[2] - u[0]) * smp->level[0].cols;
+	float v2 = (v[2] - v[0]) * smp->level[0].rows;
+	float texels = fabsf(u1 * v2 - u2 * v1);
+	float pixels = fabsf((s1[X] - s0[X]) * (s2[Y] - s0[Y]) -
+				(s2[X] - s0[X]) * (s1[Y] - s0[Y]));
+	int k = 0;
+	while(k + 1 < smp->levels && texels > 4 * pixels){
+		k++;
+		texels /= 4;
+	};
+	st->texture = &(smp->level[k]);
+	st->th = st->texture->cols;
+	st->tw = st->texture->rows;
+};
+
+/*texture coords of the corners of triangle c, clip corners included*/
+static inline void CornerUV(draw_call *d, uint32_t *c, float *u, float *v){
+	vertex_cache *vc = &(d->cam->cache);
+	for(int k = 0; k < 3; k++){
+		if(c[k] < (uint32_t)vc->corners){
+			u[k] = d->m->u[c[k]];
+			v[k] = d->m->v[c[k]];
+		}else{
+			u[k] = vc->u[c[k] - vc->corners];
+			v[k] = vc->v[c[k] - vc->corners];
+		};
+	};
+};
+
+/*corners of the mesh triangle that c is (or was cut from)*/
+static inline uint32_t *SourceCorners(draw_call *d, uint32_t *c){
+	vertex_cache *vc = &(d->cam->cache);
+	if(c >= vc->index && c < vc->index + 3 * vc->triangles)
+		return &(d->m->index[3 * vc->source[(c - vc->index) / 3]]);
+	return c;
+};
+
+/*1/w plane of triangle c, q - 1/w of its corners*/
+static inline void WarpSetup(vertex_cache *vc, uint32_t *c,
+		vector s0, vector s1, vector s2, triangle_setup *st, float *q){
+	q[0] = vc->rw[c[0]]; q[1] = vc->rw[c[1]]; q[2] = vc->rw[c[2]];
+	AttributeSetup(s0, s1, s2, q[0], q[1], q[2], &(st->q));
+};
+
+/*flat intensity by the face normal*/
+static float FaceLight(wavefront_mesh *m, uint32_t *c){
+	vector p0, p1, p2, u, v, n;
+	COPY_MESH_POINT(m,c[0],p0);
+	COPY_MESH_POINT(m,c[1],p1);
+	COPY_MESH_POINT(m,c[2],p2);
+	vec_sub(p1,p0,u); vec_sub(p2,p0,v);
+	vec_cross(v,u,n); vec_normalize(n);
+	return Illuminate(n);
+};
+
+/*triangle-setup*/
+static int SetupShaded(draw_call *d, uint32_t *c,
+			vector s0, vector s1, vector s2, triangle_setup *st){
+	PlaneSetup(s0, s1, s2, &(st->z));
+	return AdjustIntensity(d->color, FaceLight(d->m, SourceCorners(d, c)));
+};
+
+/*triangle-setup*/
+static int SetupTextured(draw_call *d, uint32_t *c,
+			vector s0, vector s1, vector s2, triangle_setup *st){
+	float q[3];
+	PlaneSetup(s0, s1, s2, &(st->z));
+	WarpSetup(&(d->cam->cache), c, s0, s1, s2, st, q);
+	float u[3], v[3];
+	CornerUV(d, c, u, v);
+	MipSetup(u, v, s0, s1, s2, st);
+	TEXTURE_SETUP(*st,u,v,s0,s1,s2,q);
+	float intensy = FaceLight(d->m, SourceCorners(d, c));
+	AttributeSetup(s0, s1, s2, intensy, intensy, intensy, &(st->light));
+	return d->color;
+};
+
+/*triangle-setup*/
+static int SetupGouraud(draw_call *d, uint32_t *c,
+			vector s0, vector s1, vector s2, triangle_setup *st){
+	float *light = d->cam->cache.light;
+	float q[3];
+	PlaneSetup(s0, s1, s2, &(st->z));
+	WarpSetup(&(d->cam->cache), c, s0, s1, s2, st, q);
+	if(st->texture != NULL){
+		float u[3], v[3];
+		CornerUV(d, c, u, v);
+		MipSetup(u, v, s0, s1, s2, st);
+		TEXTURE_SETUP(*st,u,v,s0,s1,s2,q);
+	};
+	AttributeSetup(s0, s1, s2, light[c[0]] * q[0], light[c[1]] * q[1],
+					light[c[2]] * q[2], &(st->light));
+	return d->color;
 };
 
 void RenderShaded(window *w, camera *cam, wavefront_obj *obj, int color){
+	BindWindow(w, cam);
+	if(!ProcessVertices(cam, obj->mesh, FALSE))
+		return;
 	if(cam->buf_refill_required){
-		FillZBuffer(w, cam, obj);
+		if(cam->depth_prepass)
+			FillZBuffer(w, cam, obj);
 		cam->buf_refill_required = FALSE;
 	};
-	int i = 0; vector u,v,n; float intensy = 1;
-	vector p0, p1, p2;
-	fixed z0,z1,z2; int x0,y0,x1,y1,x2,y2;
-	void *data[4] = {&z0, &z1, &z2, cam->zbuffer};
-	while(FACE(obj,i) != NULL){
-		polygon *fst = FACE(obj,i);
-		polygon *prv = FACE(obj,i)->next;
-		polygon *cur = (FACE(obj,i)->next)->next;
-		COPY_POINT(obj,fst->v,p0);
-		if(cam->Capture(p0, cam, &x0, &y0, &z0))
-			continue;
-		do {
-			COPY_POINT(obj,prv->v,p1);
-			COPY_POINT(obj,cur->v,p2);
-			if(cam->Capture(p1, cam, &x1, &y1, &z1) ||
-			   cam->Capture(p2, cam, &x2, &y2, &z2)){
-			   	prv = cur;
-				cur = cur->next;
-				continue;
-			};
-			vec_sub(p1,p0,u); vec_sub(p2,p0,v);
-			vec_cross(v,u,n); vec_normalize(n);
-			intensy = vec_dot(SUN,n);
-			intensy = (1-intensy)*SHADOW + intensy;
-			if(intensy <= 0){
-				intensy = -intensy *REFLEX;
-			}
-			int newcol = AdjustIntensity(color,intensy);
-			DrawTriangle(w,x0,y0,x1,y1,x2,y2,
-					DepthPlot,newcol,data);
-			prv = cur;
-			cur = cur->next;
-		}while(cur != NULL);
-		i++;
-	};
-};
-
-/*plotter-func*/
-static void TexturePlot(window *w, int x, int y, int color, void *user_data){
-	void **data = (void **)user_data;
-	fixed z0 = *((int *)(data[0]));
-	fixed z1 = *((int *)(data[1]));
-	fixed z2 = *((int *)(data[2]));
-	fixed z = div((z0+z1+z2),3);
-	fixed **zbuffer = ((fixed **)(data[3]));
-	TGAimage *texture = ((TGAimage *)(data[4]));
-	vector t0,t1,t2;
-	t0[X] = ((float *)(data[5]))[Y]; t0[Y] = ((float *)(data[5]))[X];
-	t1[X] = ((float *)(data[6]))[Y]; t1[Y] = ((float *)(data[6]))[X];
-	t2[X] = ((float *)(data[7]))[Y]; t2[Y] = ((float *)(data[7]))[X];
-	vector p0 = {(float)(*((int *)(data[8]))),(float)(*((int *)(data[9]))),FIXED_TO_FLOAT(z0)};
-	vector p1 = {(float)(*((int *)(data[10]))),(float)(*((int *)(data[11]))),FIXED_TO_FLOAT(z1)};
-	vector p2 = {(float)(*((int *)(data[12]))),(float)(*((int *)(data[13]))),FIXED_TO_FLOAT(z2)};
-	float lambda0, lambda1, lambda2;
-	Barycentric(x, y, p0, p1, p2, &lambda0, &lambda1, &lambda2);
-	float u = lambda0 * t0[X] + lambda1 * t1[X] + lambda2 * t2[X];
-	float v = lambda0 * t0[Y] + lambda1 * t1[Y] + lambda2 * t2[Y];
-	int tw = get_width(texture);
-	int th = get_height(texture);
-	float i = (*((float *)(data[14])));
-	if (u >= 0 && u < 1 && v >= 0 && v < 1) {
-        	color = get_pixel(texture, (int)(v * th), (int)(u * tw));
-    	}
-	if(z <= zbuffer[x][y]){
-		int newcol = AdjustIntensity(color,i);
-		io_SetPixel(w,x,y,newcol);
-	}
+	draw_call d = {w, cam, obj->mesh, SetupShaded, SPAN(cam, SPAN_FLAT),
+							color, NULL,
+							!obj->two_sided};
+	DrawMesh(&d);
 };
 
 void RenderTextured(window *w, camera *cam, wavefront_obj *obj, TGAimage *texture){
+	BindWindow(w, cam);
 	if(obj->texture == NULL || texture == NULL){
 		RenderShaded(w,cam,obj, MISSED_TEXTURE_COLOR);
 		return;
 	};
+	if(!ProcessVertices(cam, obj->mesh, FALSE))
+		return;
 	if(cam->buf_refill_required){
-		FillZBuffer(w, cam, obj);
+		if(cam->depth_prepass)
+			FillZBuffer(w, cam, obj);
 		cam->buf_refill_required = FALSE;
 	};
-	int i = 0; vector u,v,n; float intensy = 1;
-	vector p0, p1, p2;
-	vector t0,t1,t2;
-	fixed z0,z1,z2; int x0,y0,x1,y1,x2,y2;
-	void *data[15] = {&z0, &z1,&z2,cam->zbuffer,texture,t0,t1,t2,
-			   &x0, &y0, &x1, &y1, &x2, &y2,&intensy};
-	while(FACE(obj,i) != NULL){
-		polygon *fst = FACE(obj,i);
-		polygon *prv = FACE(obj,i)->next;
-		polygon *cur = (FACE(obj,i)->next)->next;
-		COPY_POINT(obj,fst->v,p0);
-		COPY_TEXTURE(obj,fst->vt,t0);
-		if(cam->Capture(p0, cam, &x0, &y0, &z0))
-			continue;
-		do {
-			COPY_POINT(obj,prv->v,p1);
-			COPY_TEXTURE(obj,prv->vt,t1);
-			COPY_POINT(obj,cur->v,p2);
-			COPY_TEXTURE(obj,cur->vt,t2);
-			if(cam->Capture(p1, cam, &x1, &y1, &z1) ||
-			   cam->Capture(p2, cam, &x2, &y2, &z2)){
-			   	prv = cur;
-				cur = cur->next;
-				continue;
-			};
-			vec_sub(p1,p0,u); vec_sub(p2,p0,v);
-			vec_cross(v,u,n); vec_normalize(n);
-			intensy = vec_dot(SUN,n);
-			intensy = (1-intensy)*SHADOW + intensy;
-			if(intensy <= 0){
-				intensy = -intensy *REFLEX;
-			}
-			DrawTriangle(w,x0,y0,x1,y1,x2,y2,
-					TexturePlot,MISSED_TEXTURE_COLOR,data);
-			prv = cur;
-			cur = cur->next;
-		}while(cur != NULL);
-		i++;
-	};
-};
-
-static void GouraudPlot(window *w, int x, int y, int color, void *user_data){
-	void **data = (void **)user_data;
-	fixed z0 = *((int *)(data[0]));
-	fixed z1 = *((int *)(data[1]));
-	fixed z2 = *((int *)(data[2]));
-	fixed z = div((z0+z1+z2),3);
-	int textured = *((int *)(data[17]));
-	fixed **zbuffer = ((fixed **)(data[3]));
-	TGAimage *texture = ((TGAimage *)(data[4]));
-	vector t0,t1,t2;
-	if(textured){
-		t0[X] = ((float *)(data[5]))[Y]; t0[Y] = ((float *)(data[5]))[X];
-		t1[X] = ((float *)(data[6]))[Y]; t1[Y] = ((float *)(data[6]))[X];
-		t2[X] = ((float *)(data[7]))[Y]; t2[Y] = ((float *)(data[7]))[X];
-	};
-	vector p0 = {(float)(*((int *)(data[8]))),(float)(*((int *)(data[9]))),FIXED_TO_FLOAT(z0)};
-	vector p1 = {(float)(*((int *)(data[10]))),(float)(*((int *)(data[11]))),FIXED_TO_FLOAT(z1)};
-	vector p2 = {(float)(*((int *)(data[12]))),(float)(*((int *)(data[13]))),FIXED_TO_FLOAT(z2)};
-	float i0 = *((float *)(data[14]));
-	float i1 = *((float *)(data[15]));
-	float i2 = *((float *)(data[16]));
-	float lambda0, lambda1, lambda2;
-	Barycentric(x, y, p0, p1, p2, &lambda0, &lambda1, &lambda2);
-	float i = lambda0 * i0 + lambda1 * i1 + lambda2 * i2;
-	if(textured){
-		float u = lambda0 * t0[X] + lambda1 * t1[X] + lambda2 * t2[X];
-		float v = lambda0 * t0[Y] + lambda1 * t1[Y] + lambda2 * t2[Y];
-		int tw = get_width(texture);
-		int th = get_height(texture);
-		if (u >= 0 && u < 1 && v >= 0 && v < 1) {
-        		color = get_pixel(texture, (int)(v * th), (int)(u * tw));
-    		}
-	}
-	if(z <= zbuffer[x][y]){
-		int newcol = AdjustIntensity(color,i);
-		DrawAlphaPixel(w,x,y,newcol);
-	}
+	UseSampler(texture);	/*once per texture, it stays in the image*/
+	draw_call d = {w, cam, obj->mesh, SetupTextured, SPAN(cam, SPAN_TEXTURE),
+					MISSED_TEXTURE_COLOR, texture, !obj->two_sided};
+	DrawMesh(&d);
 };
 
 void RenderGouraud(window *w, camera *cam, wavefront_obj *obj,
 				TGAimage *texture, int default_color){
+	BindWindow(w, cam);
 	if(obj->normal == NULL){
 		WavefrontCalculateNormals(obj);
 	};
+	if(!ProcessVertices(cam, obj->mesh, TRUE))
+		return;
 	if(cam->buf_refill_required){
-		FillZBuffer(w, cam, obj);
+		if(cam->depth_prepass)
+			FillZBuffer(w, cam, obj);
 		cam->buf_refill_required = FALSE;
 	};
-	int i = 0;
-	int textured = (obj->texture != NULL)&&(texture != NULL);
-	float i0,i1,i2;
-	vector p0, p1, p2;
-	vector n0, n1, n2;
-	vector t0,t1,t2;
-	fixed z0,z1,z2; int x0,y0,x1,y1,x2,y2;
-	void *data[18] = {&z0, &z1,&z2,cam->zbuffer,texture,t0,t1,t2,
-			   &x0, &y0, &x1, &y1, &x2, &y2,&i0,&i1,&i2,
-			   &textured};
-	while(FACE(obj,i) != NULL){
-		polygon *fst = FACE(obj,i);
-		polygon *prv = FACE(obj,i)->next;
-		polygon *cur = (FACE(obj,i)->next)->next;
-		COPY_POINT(obj,fst->v,p0);
-		COPY_TEXTURE(obj,fst->vt,t0);
-		COPY_NORMAL(obj,fst->vn,n0);
-		if(cam->Capture(p0, cam, &x0, &y0, &z0))
-			continue;
-		do {
-			COPY_POINT(obj,prv->v,p1);
-			COPY_TEXTURE(obj,prv->vt,t1);
-			COPY_NORMAL(obj,prv->vn,n1);
-			COPY_POINT(obj,cur->v,p2);
-			COPY_TEXTURE(obj,cur->vt,t2);
-			COPY_NORMAL(obj,cur->vn,n2);
-			if(cam->Capture(p1, cam, &x1, &y1, &z1) ||
-			   cam->Capture(p2, cam, &x2, &y2, &z2)){
-			   	prv = cur;
-				cur = cur->next;
-				continue;
+	draw_call d = {w, cam, obj->mesh, SetupGouraud, SPAN(cam, SPAN_GOURAUD),
+				default_color, NULL, !obj->two_sided};
+	if(ALPHA(default_color))	/*variant is picked once per draw*/
+		d.Span = SPAN(cam, SPAN_GOURAUD_ALPHA);
+	if(obj->texture != NULL && texture != NULL){
+		UseSampler(texture);
+		d.texture = texture;
+		d.Span = SPAN(cam, SPAN_GOURAUD_TEXTURE);
+	};
+	DrawMesh(&d);
+};
+
+/*-----------------------------VISIBILITY BUFFER-----------------------------*/
+
+/*triangle-setup: the span-func gets the triangle id + 1 as its color*/
+static int SetupVisibility(draw_call *d, uint32_t *c,
+			vector s0, vector s1, vector s2, triangle_setup *st){
+	vertex_cache *vc = &(d->cam->cache);
+	PlaneSetup(s0, s1, s2, &(st->z));
+	if(c != SourceCorners(d, c))	/*cut by the near plane*/
+		return d->m->triangles + (c - vc->index) / 3 + 1;
+	return (c - d->m->index) / 3 + 1;
+};
+
+/*job: shades every pixel of the visibility buffer once, tile by tile.
+  Pixels of a triangle mostly follow each other, so d->Setup only runs
+  again when the id changes*/
+static void ShadeJob(draw_call *d){
+	camera *cam = d->cam;
+	int tiles_x = (cam->w + TILE - 1) / TILE;
+	int tiles = tiles_x * ((cam->h + TILE - 1) / TILE);
+	int alpha = d->texture != NULL || ALPHA(d->color);
+	triangle_setup st;
+	InitSetup(d, &st);
+	vector s0, s1, s2;
+	int tile;
+	while((tile = __atomic_fetch_add(&(d->next), 1, __ATOMIC_RELAXED))
+								< tiles){
+		int x0 = (tile % tiles_x) * TILE, y0 = (tile / tiles_x) * TILE;
+		uint32_t last = 0;
+		for(int y = y0; y < MIN(y0 + TILE, cam->h); y++){
+			uint32_t *id = cam->vbuffer + y * cam->w;
+			int *row = (st.frame == NULL)?NULL:
+						st.frame + y * st.fstride;
+			for(int x = x0; x < MIN(x0 + TILE, cam->w); x++){
+				if(id[x] == 0)
+					continue;
+				if(id[x] != last){
+					last = id[x];
+					uint32_t *c = TRIANGLE_CORNERS(&(cam->cache),
+							d->m, last - 1);
+					Gather(&(cam->cache), c, s0, s1, s2);
+					(d->Setup)(d, c, s0, s1, s2, &st);
+				};
+				int color = d->color;
+				float rw = 1 / PLANE_AT(st.q, x, y);
+				if(st.texture != NULL){
+					color = SPAN_TEXEL(&st,
+						PLANE_AT(st.col, x, y) * rw,
+						PLANE_AT(st.row, x, y) * rw);
+				};
+				color = AdjustIntensity(color,
+						PLANE_AT(st.light, x, y) * rw);
+				if(alpha)
+					PutAlpha(&st, d->w, row, x, y, 1, 1, &color);
+				else
+					PutOpaque(&st, d->w, row, x, y, 1, 1, &color);
 			};
-			i0 = vec_dot(SUN,n0); i0 = (1-i0)*SHADOW + i0;
-			if(i0 <= 0){ i0 = -i0 *REFLEX; }
-			i1 = vec_dot(SUN,n1); i1 = (1-i1)*SHADOW + i1;
-			if(i1 <= 0){ i1 = -i1 *REFLEX; }
-			i2 = vec_dot(SUN,n2); i2 = (1-i2)*SHADOW + i2;
-			if(i2 <= 0){ i2 = -i2 *REFLEX; }
-			DrawTriangle(w,x0,y0,x1,y1,x2,y2,
-					GouraudPlot,default_color,data);
-			prv = cur;
-			cur = cur->next;
-		}while(cur != NULL);
-		i++;
-	};
-};
-
-static fixed **ZBufferInit(int width, int height){
-	fixed **empty_buffer =  malloc((sizeof(fixed *)) *  (width + 1));
-	for(int x = 0; x < width; x++){
-		empty_buffer[x] = (fixed *)malloc(height * sizeof(fixed));
-	};
-	empty_buffer[width] = NULL;
-	for(int x = 0; x < width; x++){
-		for(int y = 0; y < height; y++){
-			empty_buffer[x][y] = INF;
 		};
 	};
-	return empty_buffer;
 };
 
-/*plotter-func*/
-static void DepthFilter(window *w, int x, int y, int color, void *user_data){
-	void **data = (void **)user_data;
-	fixed z0 = *((int *)(data[0]));
-	fixed z1 = *((int *)(data[1]));
-	fixed z2 = *((int *)(data[2]));
-	fixed z = div((z0+z1+z2),3);
-	fixed **zbuffer = ((fixed **)(data[3]));
-	if(z <= zbuffer[x][y]){
-		zbuffer[x][y] = z;
+/*RenderGouraud in two passes: depth and triangle ids of the nearest
+  surfaces first, then every visible pixel is shaded exactly once*/
+void RenderVisibility(window *w, camera *cam, wavefront_obj *obj,
+				TGAimage *texture, int default_color){
+	BindWindow(w, cam);
+	if(obj->normal == NULL){
+		WavefrontCalculateNormals(obj);
+	};
+	if(!ProcessVertices(cam, obj->mesh, TRUE))
+		return;
+	cam->buf_refill_required = FALSE;
+	render_target *t = cam->storage;
+	if(t->vbuffer == NULL)	//for the whole bucket
+		t->vbuffer = malloc(t->w * t->h * sizeof(uint32_t));
+	cam->vbuffer = t->vbuffer;
+	memset(cam->vbuffer, 0, cam->w * cam->h * sizeof(uint32_t));
+	draw_call d = {w, cam, obj->mesh, SetupVisibility,
+			SPAN(cam, SPAN_VISIBILITY), default_color, NULL,
+							!obj->two_sided};
+	DrawMesh(&d);
+	d.Setup = SetupGouraud;
+	if(obj->texture != NULL && texture != NULL){
+		UseSampler(texture);
+		d.texture = texture;
 	};
+	d.next = 0;
+	render_pool *pool = UsePool(cam);
+	LockCanvas(&d);
+	if(pool == NULL)
+		ShadeJob(&d);
+	else
+		PoolRun(pool, ShadeJob, &d);
+	io_UnlockFrame(w);
+};
+
+/*allocates (not clears) the zbuffer*/
+static void ZBufferInit(depth_buffer *zb, int width, int height, int format){
+	zb->format = format;
+	zb->size = (format == DEPTH_16)?sizeof(uint16_t):sizeof(fixed);
+	int line = ZBUFFER_ALIGN / zb->size;
+	zb->w = width;
+	zb->h = height;
+	zb->stride = (width + line - 1) / line * line;
+	zb->memory = malloc(zb->stride * height * zb->size + ZBUFFER_ALIGN);
+	zb->base = (void *)(((uintptr_t)(zb->memory) + ZBUFFER_ALIGN - 1)
+					& ~(uintptr_t)(ZBUFFER_ALIGN - 1));
 };
 
 static void FillZBuffer(window *w, camera *cam, wavefront_obj *obj){
-	int i = 0;
-	vector p0, p1, p2;
-	fixed z0,z1,z2;
-	int x0,y0,x1,y1,x2,y2;
-	void *data[4] = {&z0, &z1, &z2, cam->zbuffer};
-	while(FACE(obj,i) != NULL){
-		polygon *fst = FACE(obj,i);
-		polygon *prv = FACE(obj,i)->next;
-		polygon *cur = (FACE(obj,i)->next)->next;
-		COPY_POINT(obj,fst->v,p0);
-		if(cam->Capture(p0, cam, &x0, &y0, &z0))
-			continue;
-		do {
-			COPY_POINT(obj,prv->v,p1);
-			COPY_POINT(obj,cur->v,p2);
-			if(cam->Capture(p1, cam, &x1, &y1, &z1) ||
-			   cam->Capture(p2, cam, &x2, &y2, &z2)){
-			   	prv = cur;
-				cur = cur->next;
-				continue;
+	draw_call d = {w, cam, obj->mesh, SetupDepth, SPAN(cam, SPAN_DEPTH), 0, NULL,
+							!obj->two_sided};
+	DrawMesh(&d);
+};
+
+/*camera distance of depth x in a zbuffer row, -1 - nothing there*/
+static inline float DepthDistance(camera *cam, unsigned char *row, int x){
+	switch(cam->zbuffer.format){
+	case DEPTH_FIXED_24_8: {
+		fixed z = ((fixed *)row)[x];
+		return (z == INF)?-1:z / 256.0f;
+	};
+	case DEPTH_16: {
+		uint16_t z = ((uint16_t *)row)[x];
+		return (z == 0xFFFF)?-1:z * (cam->far / 65535);
+	};
+	case DEPTH_FLOAT_REVERSED: {
+		float z = ((float *)row)[x];
+		return (z == 0)?-1:1 / z;
+	};
+	default: {
+		fixed z = ((fixed *)row)[x];
+		return (z == INF)?-1:FIXED_TO_INT(z);
+	};
+	};
+};
+
+/*job: grayscale picture of the zbuffer tile by tile*/
+static void ShowDepthJob(draw_call *d){
+	camera *cam = d->cam;
+	int tiles_x = (cam->w + TILE - 1) / TILE;
+	int tiles = tiles_x * ((cam->h + TILE - 1) / TILE);
+	int tile;
+	while((tile = __atomic_fetch_add(&(d->next), 1, __ATOMIC_RELAXED))
+								< tiles){
+		int x0 = (tile % tiles_x) * TILE, y0 = (tile / tiles_x) * TILE;
+		for(int y = y0; y < MIN(y0 + TILE, cam->h); y++){
+			unsigned char *row = ZBUFFER_ROW(&(cam->zbuffer), y);
+			int *frame = (d->fb.base == NULL)?NULL:
+						d->fb.base + y * d->fb.stride;
+			for(int x = x0; x < MIN(x0 + TILE, cam->w); x++){
+				int color = 0xFF000000;
+				float far = DepthDistance(cam, row, x);
+				if(far >= 0){
+					color = ConvertToGrayARGB((int)far,
+							d->max_depth);
+				};
+				if(frame != NULL)
+					frame[x] = color;
+				else
+					io_SetPixel(d->w,x,y,color);
 			};
-			DrawTriangle(w,x0,y0,x1,y1,x2,y2,DepthFilter,0,data);
-			prv = cur;
-			cur = cur->next;
-		} while(cur != NULL);
-		i++;
+		};
 	};
 };
 
 void RenderZBuffer(window *w, camera *cam,wavefront_obj *obj, int max_depth){
+	BindWindow(w, cam);
 	if(cam->buf_refill_required){
-		FillZBuffer(w, cam, obj);
+		if(ProcessVertices(cam, obj->mesh, FALSE))
+			FillZBuffer(w, cam, obj);
 		cam->buf_refill_required = FALSE;
 	};
-	for(int x = 0; x < cam->w; x++){
-		for(int y = 0; y < cam->h; y++){
-			if(cam->zbuffer[x][y] != INF){
-				int color = ConvertToGrayARGB(
-					FIXED_TO_INT(cam->zbuffer[x][y]),
-					max_depth);
-				DrawPixel(w,x,y,color);
-			}else{
-				DrawPixel(w,x,y,0xFF000000);
+	draw_call d = {.w = w, .cam = cam, .max_depth = max_depth, .next = 0};
+	render_pool *pool = UsePool(cam);
+	LockCanvas(&d);
+	if(pool == NULL)
+		ShowDepthJob(&d);
+	else
+		PoolRun(pool, ShowDepthJob, &d);
+	io_UnlockFrame(w);
+};
+
+/*----------------------------BINNING RENDERER-----------------------------*/
+
+static void InitSetup(draw_call *d, triangle_setup *st){
+	memset(st, 0, sizeof(triangle_setup));
+	st->zbase = d->cam->zbuffer.base;
+	st->zstride = d->cam->zbuffer.stride;
+	st->zformat = d->cam->zbuffer.format;
+	st->vbuffer = d->cam->vbuffer;
+	st->vstride = d->cam->w;
+	st->hiz = d->cam->hiz;
+	st->frame = d->fb.base;
+	st->fstride = d->fb.stride;
+	if(d->texture != NULL){
+		st->sampler = d->texture->sampler;
+		st->texture = &(st->sampler->level[0]);
+		st->th = st->texture->cols;
+		st->tw = st->texture->rows;
+	};
+};
+
+/*puts triangle t into the bins of the tiles it overlaps*/
+static void BinTriangle(draw_call *d, render_pool *p, int t){
+	vertex_cache *vc = &(d->cam->cache);
+	uint32_t *c = TRIANGLE_CORNERS(vc, d->m, t);
+	if(vc->clip[c[0]] | vc->clip[c[1]] | vc->clip[c[2]])
+		return;
+	if(d->cull && BackFace(vc, c))
+		return;
+	/*pixels under the corners: scanline builds of basics draw
+	  those, not only the ones with the centre inside*/
+	int min_x = FIXED_TO_INT(MIN(MIN(vc->x[c[0]], vc->x[c[1]]),
+							vc->x[c[2]]));
+	int max_x = FIXED_TO_INT(MAX(MAX(vc->x[c[0]], vc->x[c[1]]),
+							vc->x[c[2]]));
+	int min_y = FIXED_TO_INT(MIN(MIN(vc->y[c[0]], vc->y[c[1]]),
+							vc->y[c[2]]));
+	int max_y = FIXED_TO_INT(MAX(MAX(vc->y[c[0]], vc->y[c[1]]),
+							vc->y[c[2]]));
+	if(max_x < 0 || max_y < 0 ||
+	   min_x >= d->cam->w || min_y >= d->cam->h)
+		return;
+	min_x = MAX(min_x, 0) / TILE;
+	min_y = MAX(min_y, 0) / TILE;
+	max_x = MIN(max_x, d->cam->w - 1) / TILE;
+	max_y = MIN(max_y, d->cam->h - 1) / TILE;
+	for(int ty = min_y; ty <= max_y; ty++){
+		for(int tx = min_x; tx <= max_x; tx++){
+			tile_bin *b = &(p->bin[ty * p->tiles_x + tx]);
+			if(b->count == b->size){
+				b->size = (b->size)?(b->size * 2):(64);
+				b->tri = realloc(b->tri,
+					b->size * sizeof(uint32_t));
 			};
+			b->tri[b->count++] = t;
 		};
 	};
 };
 
+/*sorts visible triangles into the bins of the tiles they overlap*/
+static void BinTriangles(draw_call *d, render_pool *p){
+	vertex_cache *vc = &(d->cam->cache);
+	wavefront_mesh *m = d->m;
+	for(int b = 0; b < p->tiles_x * p->tiles_y; b++)
+		p->bin[b].count = 0;
+	FOR_VISIBLE_TRIANGLES(vc,m,t)
+		BinTriangle(d, p, t);
+	FOR_CLIPPED_TRIANGLES(vc,m,t)
+		BinTriangle(d, p, t);
+};
+
+/*pixels from the one under the top left screen corner to the one under
+  the bottom right (the scanline rasterizer may draw those), cut by clip,
+  FALSE - nothing left*/
+static inline int TriangleArea(vector s0, vector s1, vector s2,
+					scissor *clip, scissor *box){
+	box->x0 = MAX((int)floorf(MIN(MIN(s0[X], s1[X]), s2[X]) + 0.5f),
+								clip->x0);
+	box->y0 = MAX((int)floorf(MIN(MIN(s0[Y], s1[Y]), s2[Y]) + 0.5f),
+								clip->y0);
+	box->x1 = MIN((int)floorf(MAX(MAX(s0[X], s1[X]), s2[X]) + 0.5f),
+								clip->x1);
+	box->y1 = MIN((int)floorf(MAX(MAX(s0[Y], s1[Y]), s2[Y]) + 0.5f),
+								clip->y1);
+	return box->x0 <= box->x1 && box->y0 <= box->y1;
+};
+
+/*triangle is behind everything drawn under its bounding box*/
+static inline int Occluded(camera *cam, vector s0, vector s1, vector s2,
+							scissor *clip){
+	scissor box;
+	if(!TriangleArea(s0, s1, s2, clip, &box))
+		return TRUE;
+	int f = cam->zbuffer.format;
+	fixed near = MIN(MIN(DepthKey(f, s0[Z]), DepthKey(f, s1[Z])),
+							DepthKey(f, s2[Z]));
+	return HiZOccluded(cam->hiz, &box, near);
+};
+
+/*job: every tile is drawn by one worker into its own zbuffer slice*/
+static void TileJob(draw_call *d){
+	camera *cam = d->cam;
+	render_pool *p = cam->pool;
+	depth_buffer *zb = &(cam->zbuffer);
+	unsigned char depth[TILE * TILE * sizeof(fixed)]
+					__attribute__((aligned(ZBUFFER_ALIGN)));
+	triangle_setup st;
+	InitSetup(d, &st);
+	st.zbase = depth;
+	st.zstride = TILE;
+	vector s0, s1, s2;
+	int tile;
+	while((tile = __atomic_fetch_add(&(d->next), 1, __ATOMIC_RELAXED))
+					< p->tiles_x * p->tiles_y){
+		tile_bin *b = &(p->bin[tile]);
+		if(b->count == 0)
+			continue;
+		scissor clip;
+		clip.x0 = (tile % p->tiles_x) * TILE;
+		clip.y0 = (tile / p->tiles_x) * TILE;
+		clip.x1 = MIN(clip.x0 + TILE, cam->w) - 1;
+		clip.y1 = MIN(clip.y0 + TILE, cam->h) - 1;
+		int row = (clip.x1 - clip.x0 + 1) * zb->size;
+		st.zx = clip.x0; st.zy = clip.y0;
+		for(int y = clip.y0; y <= clip.y1; y++)
+			memcpy(depth + (y - clip.y0) * TILE * zb->size,
+				ZBUFFER_ROW(zb, y) + clip.x0 * zb->size, row);
+		HiZRefresh(cam->hiz, &st, &clip);
+		for(int i = 0; i < b->count; i++){
+			uint32_t *c = TRIANGLE_CORNERS(&(cam->cache), d->m,
+							b->tri[i]);
+			Gather(&(cam->cache), c, s0, s1, s2);
+			if(Occluded(cam, s0, s1, s2, &clip))
+				continue;
+			int color = (d->Setup)(d, c, s0, s1, s2, &st);
+			DRAW_TRIANGLE(d, &(cam->cache), c, &clip, color, &st);
+		};
+		for(int y = clip.y0; y <= clip.y1; y++)
+			memcpy(ZBUFFER_ROW(zb, y) + clip.x0 * zb->size,
+				depth + (y - clip.y0) * TILE * zb->size, row);
+	};
+};
+
+/*draws triangle c on the canvas (no binning)*/
+static inline void DrawSingle(draw_call *d, uint32_t *c, scissor *canvas,
+							triangle_setup *st){
+	vertex_cache *vc = &(d->cam->cache);
+	vector s0, s1, s2;
+	if(Gather(vc, c, s0, s1, s2))
+		return;
+	if(d->cull && BackFace(vc, c))
+		return;
+	if(Occluded(d->cam, s0, s1, s2, canvas))
+		return;
+	int color = (d->Setup)(d, c, s0, s1, s2, st);
+	DRAW_TRIANGLE(d, vc, c, canvas, color, st);
+};
+
+/*draws every visible triangle of d->m with d->Setup and d->Span*/
+/*locks the canvas of d->w for span-funcs, only a canvas covering the
+  whole camera is written directly*/
+static void LockCanvas(draw_call *d){
+	if(!io_LockFrame(d->w, &(d->fb)) || d->fb.format != IO_FORMAT_ARGB32
+			|| d->fb.width < d->cam->w || d->fb.height < d->cam->h)
+		d->fb.base = NULL;
+};
+
+static void DrawMesh(draw_call *d){
+	render_pool *pool = UsePool(d->cam);
+	LockCanvas(d);
+	if(pool != NULL){
+		BinTriangles(d, pool);
+		d->next = 0;
+		PoolRun(pool, TileJob, d);
+	}else{
+		wavefront_mesh *m = d->m;
+		triangle_setup st;
+		InitSetup(d, &st);
+		vertex_cache *vc = &(d->cam->cache);
+		scissor canvas = {0, 0, d->cam->w - 1, d->cam->h - 1};
+		HiZRefresh(d->cam->hiz, &st, &canvas);
+		FOR_VISIBLE_TRIANGLES(vc,m,t)
+			DrawSingle(d, TRIANGLE_CORNERS(vc, m, t), &canvas, &st);
+		FOR_CLIPPED_TRIANGLES(vc,m,t)
+			DrawSingle(d, TRIANGLE_CORNERS(vc, m, t), &canvas, &st);
+	};
+	io_UnlockFrame(d->w);
+};
+
+static void *PoolWorker(void *data){
+	render_pool *p = (render_pool *)data;
+	int seen = 0;
+	pthread_mutex_lock(&(p->lock));
+	for(;;){
+		while(p->round == seen && !p->quit)
+			pthread_cond_wait(&(p->start), &(p->lock));
+		if(p->quit)
+			break;
+		seen = p->round;
+		pthread_mutex_unlock(&(p->lock));
+		(p->Job)(p->d);
+		pthread_mutex_lock(&(p->lock));
+		if(--(p->busy) == 0)
+			pthread_cond_signal(&(p->finish));
+	};
+	pthread_mutex_unlock(&(p->lock));
+	return NULL;
+};
+
+/*runs Job on every worker and on the caller, returns when all are done*/
+static void PoolRun(render_pool *p, void (*Job)(draw_call *), draw_call *d){
+	pthread_mutex_lock(&(p->lock));
+	p->Job = Job;
+	p->d = d;
+	p->busy = p->count;
+	p->round++;
+	pthread_cond_broadcast(&(p->start));
+	pthread_mutex_unlock(&(p->lock));
+	Job(d);
+	pthread_mutex_lock(&(p->lock));
+	while(p->busy > 0)
+		pthread_cond_wait(&(p->finish), &(p->lock));
+	pthread_mutex_unlock(&(p->lock));
+};
+
+/*(re)starts the pool when cam->threads has changed, NULL - no threads*/
+static render_pool *UsePool(camera *cam){
+	if(cam->pool != NULL && cam->pool->count == cam->threads - 1){
+		PoolTiles(cam->pool, cam);
+		return cam->pool;
+	};
+	FreePool(cam->pool);
+	cam->pool = NULL;
+	if(cam->threads <= 1)
+		return NULL;
+	render_pool *p = calloc(1, sizeof(render_pool));
+	PoolTiles(p, cam);
+	pthread_mutex_init(&(p->lock), NULL);
+	pthread_cond_init(&(p->start), NULL);
+	pthread_cond_init(&(p->finish), NULL);
+	p->worker = malloc((cam->threads - 1) * sizeof(pthread_t));
+	for(p->count = 0; p->count < cam->threads - 1; p->count++){
+		if(pthread_create(&(p->worker[p->count]), NULL,
+						PoolWorker, p) != 0)
+			break;
+	};
+	cam->pool = p;
+	return p;
+};
+
+/*tile grid of the camera size, bins only grow*/
+static void PoolTiles(render_pool *p, camera *cam){
+	p->tiles_x = (cam->w + TILE - 1) / TILE;
+	p->tiles_y = (cam->h + TILE - 1) / TILE;
+	int bins = p->tiles_x * p->tiles_y;
+	if(bins <= p->bins)
+		return;
+	p->bin = realloc(p->bin, bins * sizeof(tile_bin));
+	memset(p->bin + p->bins, 0, (bins - p->bins) * sizeof(tile_bin));
+	p->bins = bins;
+};
+
+static void FreePool(render_pool *p){
+	if(p == NULL)
+		return;
+	pthread_mutex_lock(&(p->lock));
+	p->quit = TRUE;
+	pthread_cond_broadcast(&(p->start));
+	pthread_mutex_unlock(&(p->lock));
+	for(int i = 0; i < p->count; i++)
+		pthread_join(p->worker[i], NULL);
+	pthread_mutex_destroy(&(p->lock));
+	pthread_cond_destroy(&(p->start));
+	pthread_cond_destroy(&(p->finish));
+	for(int b = 0; b < p->bins; b++)
+		free(p->bin[b].tri);
+	free(p->bin);
+	free(p->worker);
+	free(p);
+};
+
 static void CleanZBuffer(camera *cam){
-	if(cam->zbuffer == NULL)
+	depth_buffer *zb = &(cam->zbuffer);
+	if(zb->base == NULL)
 		return;
-	for(int x = 0; x < cam->w; x++){
-		for(int y = 0; y < cam->h; y++){
-			cam->zbuffer[x][y] = INF;
+	/*padding included: one linear fill per format*/
+	int count = zb->stride * zb->h;
+	fixed far = INF;
+	if(zb->format == DEPTH_16){
+		memset(zb->base, 0xFF, count * sizeof(uint16_t));
+		far = 0xFFFF;
+	}else if(zb->format == DEPTH_FLOAT_REVERSED){
+		memset(zb->base, 0, count * sizeof(float));	//0.0f
+	}else{
+		fixed *z = zb->base;
+		for(int i = 0; i < count; i++)
+			z[i] = INF;
+	};
+	for(int l = 0; l < HIZ_LEVELS; l++){
+		hiz_level *hl = &(cam->hiz[l]);
+		for(int b = 0; b < hl->w * hl->h; b++)
+			hl->zmax[b] = far;
+		memset(hl->dirty, FALSE, hl->w * hl->h);
+	};
+	cam->storage->owner = cam;
+};
+
+/*-------------------------------RENDER TARGETS------------------------------*/
+
+/*views of the camera into a target of its size and format (the depths
+  are lost)*/
+static void BindTarget(camera *cam, int width, int height, int format){
+	render_target *old = cam->storage;
+	cam->storage = AcquireTarget(width, height, format);
+	if(old != NULL)
+		ReleaseTarget(old, cam);
+	render_target *t = cam->storage;
+	cam->w = width;
+	cam->h = height;
+	cam->hw = width / 2;
+	cam->hh = height / 2;
+	cam->zbuffer = t->zbuffer;
+	cam->zbuffer.w = width;
+	cam->zbuffer.h = height;
+	for(int l = 0; l < HIZ_LEVELS; l++){
+		int size = t->hiz[l].size;
+		cam->hiz[l] = t->hiz[l];
+		cam->hiz[l].w = (width + size - 1) / size;
+		cam->hiz[l].h = (height + size - 1) / size;
+	};
+	cam->vbuffer = t->vbuffer;
+	CleanZBuffer(cam);
+	cam->buf_refill_required = TRUE;
+};
+
+/*called by renderers: follows the size of the window, takes the depths
+  back from another camera of the target*/
+static void BindWindow(window *w, camera *cam){
+	int width = io_GetWidth(w), height = io_GetHeight(w);
+	if(width != cam->w || height != cam->h){
+		BindTarget(cam, width, height, cam->zbuffer.format);
+	}else if(cam->storage->owner != cam){
+		CleanZBuffer(cam);
+		cam->buf_refill_required = TRUE;
+	};
+};
+
+static render_target *AcquireTarget(int width, int height, int format){
+	int bw = (width + TARGET_STEP - 1) / TARGET_STEP * TARGET_STEP;
+	int bh = (height + TARGET_STEP - 1) / TARGET_STEP * TARGET_STEP;
+	for(render_target *t = targets; t != NULL; t = t->next)
+		if(t->w == bw && t->h == bh && t->format == format){
+			t->users++;
+			return t;
 		};
+	render_target *t = calloc(1, sizeof(render_target));
+	t->w = bw;
+	t->h = bh;
+	t->format = format;
+	t->users = 1;
+	ZBufferInit(&(t->zbuffer), bw, bh, format);
+	HiZInit(t->hiz, bw, bh);
+	t->next = targets;
+	targets = t;
+	return t;
+};
+
+/*the last user puts t into the pool, the pool drops the oldest ones*/
+static void ReleaseTarget(render_target *t, camera *cam){
+	t->users--;
+	if(t->owner == cam)
+		t->owner = NULL;
+	int pooled = 0;
+	for(render_target **p = &targets; *p != NULL;){
+		render_target *c = *p;
+		if(c->users > 0 || ++pooled <= TARGET_POOL){
+			p = &(c->next);
+			continue;
+		};
+		*p = c->next;
+		ZBufferFree(&(c->zbuffer));
+		for(int l = 0; l < HIZ_LEVELS; l++){
+			free(c->hiz[l].zmax);
+			free(c->hiz[l].dirty);
+		};
+		free(c->vbuffer);
+		free(c);
 	};
 };
 
-static void ZBufferFree(fixed **ZBuffer){
-	int x = 0;
-	while(ZBuffer[x] != NULL){
-		free(ZBuffer[x]);
-		x++;
+/*------------------------------HIERARCHICAL Z------------------------------*/
+
+static void HiZInit(hiz_level *hiz, int width, int height){
+	int size = 8;
+	for(int l = 0; l < HIZ_LEVELS; l++, size *= 8){
+		hiz_level *hl = &(hiz[l]);
+		hl->size = size;
+		hl->w = (width + size - 1) / size;
+		hl->h = (height + size - 1) / size;
+		hl->zmax = malloc(hl->w * hl->h * sizeof(fixed));
+		hl->dirty = calloc(hl->w * hl->h, sizeof(unsigned char));
 	};
-	free(ZBuffer);
+};
+
+/*camera depth z in units of the zbuffer format*/
+static inline float DepthValue(camera *cam, float z){
+	switch(cam->zbuffer.format){
+	case DEPTH_FIXED_24_8:
+		return z * 256;
+	case DEPTH_16:
+		return z * (65535 / cam->far);
+	case DEPTH_FLOAT_REVERSED:
+		return 1 / z;
+	default:
+		return z * (1 << N);
+	};
+};
+
+/*hiz key of depth z: grows with the distance in every format. Bits of
+  a positive float grow with it, so 1/z gets a reversed integer key*/
+static inline fixed DepthKey(int format, float z){
+	if(format == DEPTH_FLOAT_REVERSED){
+		union {float f; int32_t i;} bits = {z};
+		return INF - bits.i;
+	};
+	return (fixed)z;
+};
+
+/*key of the farthest depth in x0..x1, y0..y1 of the zbuffer slice*/
+static fixed BlockFar(triangle_setup *st, int x0, int y0, int x1, int y1){
+	fixed far = 0;
+	if(st->zformat == DEPTH_FLOAT_REVERSED){
+		float z = FLT_MAX;
+		for(int y = y0; y <= y1; y++){
+			float *row = SLICE_ROW(st, float, y);
+			for(int x = x0; x <= x1; x++)
+				z = MIN(z, row[x]);
+		};
+		return DepthKey(DEPTH_FLOAT_REVERSED, z);
+	};
+	if(st->zformat == DEPTH_16){
+		for(int y = y0; y <= y1; y++){
+			uint16_t *row = SLICE_ROW(st, uint16_t, y);
+			for(int x = x0; x <= x1; x++)
+				far = MAX(far, row[x]);
+		};
+		return far;
+	};
+	for(int y = y0; y <= y1; y++){
+		fixed *row = SLICE_ROW(st, fixed, y);
+		for(int x = x0; x <= x1; x++)
+			far = MAX(far, row[x]);
+	};
+	return far;
+};
+
+/*recalculates dirty blocks inside of area (block aligned) from the
+  zbuffer as the spans of st see it*/
+static void HiZRefresh(hiz_level *hiz, triangle_setup *st, scissor *area){
+	hiz_level *l0 = &(hiz[0]);
+	for(int by = area->y0 / l0->size; by <= area->y1 / l0->size; by++){
+		for(int bx = area->x0 / l0->size; bx <= area->x1 / l0->size; bx++){
+			int b = by * l0->w + bx;
+			if(!l0->dirty[b])
+				continue;
+			int x1 = MIN(bx * l0->size + l0->size - 1, area->x1);
+			int y1 = MIN(by * l0->size + l0->size - 1, area->y1);
+			l0->zmax[b] = BlockFar(st, bx * l0->size, by * l0->size,
+								x1, y1);
+			l0->dirty[b] = FALSE;
+		};
+	};
+	for(int l = 1; l < HIZ_LEVELS; l++){
+		hiz_level *hl = &(hiz[l]), *low = &(hiz[l - 1]);
+		int k = hl->size / low->size;
+		for(int by = area->y0 / hl->size; by <= area->y1 / hl->size; by++){
+			for(int bx = area->x0/hl->size; bx <= area->x1/hl->size; bx++){
+				int b = by * hl->w + bx;
+				if(!hl->dirty[b])
+					continue;
+				fixed far = 0;
+				for(int y = by * k; y < MIN(by * k + k, low->h); y++)
+					for(int x = bx * k; x < MIN(bx * k + k, low->w); x++)
+						far = MAX(far, low->zmax[y * low->w + x]);
+				hl->zmax[b] = far;
+				hl->dirty[b] = FALSE;
+			};
+		};
+	};
+};
+
+/*every block under area already holds something nearer than z*/
+static int HiZOccluded(hiz_level *hiz, scissor *area, fixed z){
+	hiz_level *l0 = &(hiz[0]), *l1 = &(hiz[1]);
+	for(int by = area->y0 / l1->size; by <= area->y1 / l1->size; by++){
+		for(int bx = area->x0 / l1->size; bx <= area->x1 / l1->size; bx++){
+			if(l1->zmax[by * l1->w + bx] < z)
+				continue;	/*the whole 64x64 block is nearer*/
+			int x0 = MAX(area->x0, bx * l1->size) / l0->size;
+			int x1 = MIN(area->x1, bx * l1->size + l1->size - 1) / l0->size;
+			int y0 = MAX(area->y0, by * l1->size) / l0->size;
+			int y1 = MIN(area->y1, by * l1->size + l1->size - 1) / l0->size;
+			for(int y = y0; y <= y1; y++)
+				for(int x = x0; x <= x1; x++)
+					if(l0->zmax[y * l0->w + x] >= z)
+						return FALSE;
+		};
+	};
+	return TRUE;
+};
+
+static void ZBufferFree(depth_buffer *zb){
+	free(zb->memory);
+	zb->memory = NULL;
+	zb->base = NULL;
 };
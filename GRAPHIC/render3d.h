@@ -40,8 +40,88 @@
 #include "tgatool.h"
 
 typedef struct camera_t camera;
+typedef struct render_pool_t render_pool;
+typedef struct render_target_t render_target;
 
-typedef int (*Projection)(vector, camera *, int *x, int *y, fixed *z);
+/*returns 0 - visible, else CLIP_* of the point. Triangles crossing
+  the near plane are cut in camera space before they are projected*/
+enum {CLIP_NEAR = 1, CLIP_FAR = 2};
+typedef int (*Projection)(vector, camera *, fixed *x, fixed *y, float *z);
+
+/*one mesh position on the screen*/
+typedef struct {
+	fixed x, y;		//screen coordinates, 28.4 subpixels
+	float z;		//depth in units of the zbuffer format
+	float rw;		//1/w: 1/z of the camera (1 - affine)
+	int clip;		//Capture() result (0 - visible)
+} projected;
+
+/*post-transform cache: every mesh position projected once a frame, every
+  corner takes its position from there and is lit by its normal*/
+typedef struct {
+	int points;		//allocated positions
+	projected *point;	//every position of the mesh
+	int size;		//allocated corners
+	fixed *x;		//screen coordinates, 28.4 subpixels
+	fixed *y;
+	float *z;		//depth in units of the zbuffer format
+	float *rw;		//1/w: 1/z of the camera (1 - affine)
+	unsigned char *clip;	//Capture() result (0 - visible)
+	float *light;		//SUN intensity by the corner normal
+	int corners;		//corners of the mesh, clip corners follow
+	int extra;		//clip corners: made on the near plane
+	int extra_size;
+	float *u;		//texture coords of the clip corners
+	float *v;
+	int triangles;		//triangles cut from the near-clipped ones
+	int tri_size;
+	uint32_t *index;	//their corners (3 each)
+	uint32_t *source;	//mesh triangle every one was cut from
+	int clusters;		//allocated clusters
+	unsigned char *cluster;	//cluster of the mesh is in the frustum
+} vertex_cache;
+
+/*hierarchical z: the farthest depth of every block. Spans mark the
+  blocks they wrote as dirty, dirty blocks are recalculated before the
+  next draw (a stale value is only farther, so it stays conservative).
+  Depths are kept as keys growing with the distance in every format*/
+typedef struct {
+	int size;		//block side in pixels
+	int w;			//blocks in a row
+	int h;			//blocks in a column
+	fixed *zmax;		//key of the farthest depth
+	unsigned char *dirty;
+} hiz_level;
+
+#define HIZ_LEVELS 2	//8x8 and 64x64 blocks
+
+/*formats of the zbuffer (SetDepthFormat):
+  DEPTH_FIXED_28_4	- fixed as it is, the default
+  DEPTH_FIXED_24_8	- 32 bit, 16 times finer than 28.4 (up to 8M units).
+			  Depth is computed in float: farther than 65536
+			  the extra fraction bits are lost
+  DEPTH_16		- 16 bit, camera->far split into 65535 steps
+  DEPTH_FLOAT_REVERSED	- float 1/z, nearer is greater, the empty buffer
+			  holds 0. Precision follows the distance*/
+enum {DEPTH_FIXED_28_4, DEPTH_FIXED_24_8, DEPTH_16, DEPTH_FLOAT_REVERSED,
+								DEPTH_FORMATS};
+
+/*zbuffer is one aligned block in row-major order, depth of (x,y) is
+  in the row ZBUFFER_ROW(zb,y) at x. Rows are padded to whole cache
+  lines, so the clear is a single linear fill*/
+typedef struct {
+	void *memory;		//what malloc returned
+	void *base;		//memory aligned to ZBUFFER_ALIGN
+	int stride;		//depths in a row
+	int size;		//bytes of a depth
+	int format;
+	int w;
+	int h;
+} depth_buffer;
+
+#define ZBUFFER_ALIGN 64
+#define ZBUFFER_ROW(zb,y) \
+		((unsigned char *)(zb)->base + (y) * (zb)->stride * (zb)->size)
 
 struct camera_t{
 	Projection Capture;
@@ -50,12 +130,23 @@ struct camera_t{
 	vector dir; //x_aix
 	vector y_aix;
 	vector z_aix;
-	fixed **zbuffer;
+	render_target *storage;	//owns the memory of zbuffer, hiz and vbuffer
+	depth_buffer zbuffer;	//views of the target sized w*h
+	hiz_level hiz[HIZ_LEVELS];
+	uint32_t *vbuffer;	//RenderVisibility: triangle id + 1 (w*h)
+	vertex_cache cache;
 	int buf_refill_required;
+	int depth_prepass;	//fill zbuffer in a separate pass before colour
+				//(hierarchical z then rejects hidden triangles)
+	int perspective_correct;//attributes by 1/w, else affine on screen
+	int threads;		//>1 - tile-binned rendering by a thread pool
+				//(not for io_ncurses: io_SetPixel is not reentrant)
+	render_pool *pool;
 	float fov;
+	float near;
 	float far;
-	int w;
-	int h;
+	int w;			//size of the window, renderers rebind the
+	int h;			//camera when it has changed
 	int hw;
 	int hh;
 };
@@ -64,8 +155,11 @@ struct camera_t{
 camera *InitCamera(window *w,int x0,int y0,int z0,int x1,int y1,int z1,int fov);
 void MoveCamera(camera *cam, vector new_pos, vector new_target);
 void FreeCamera(camera *cam);
-int PerspectiveProjection(vector p, camera *cam, int *x, int *y, fixed *z);
-int OrthographicProjection(vector p, camera *cam, int *x, int *y, fixed *z);
+void SetDepthFormat(camera *cam, int format);
+int PerspectiveProjection(vector p, camera *cam, fixed *x, fixed *y,
+								float *z);
+int OrthographicProjection(vector p, camera *cam, fixed *x, fixed *y,
+								float *z);
 
 /*2. RENDERERS */
 void RenderZBuffer(window *w, camera *cam,wavefront_obj *obj, int max_depth);
@@ -74,4 +168,6 @@ void RenderShaded(window *w, camera *cam, wavefront_obj *obj, int color);
 void RenderTextured(window *w, camera *cam, wavefront_obj *obj, TGAimage *texture);
 void RenderGouraud(window *w, camera *cam, wavefront_obj *obj,
 				TGAimage *texture, int default_color);
+void RenderVisibility(window *w, camera *cam, wavefront_obj *obj,
+				TGAimage *texture, int default_color);
 #endif
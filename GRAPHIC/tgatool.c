@@ -33,11 +33,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "tgatool.h"
 
 //---------------------------------[SOME_MATH]----------------------------------
 
 #define ABS(number) (((number) > 0)?(number):(-(number)))
+#define MAX(a,b) (((a) > (b))?(a):(b))
 
 static int expon(int base, int power){
 	if(power == 0){
@@ -239,7 +241,7 @@ typedef struct tag_tgafooters{
 }__attribute__((packed)) tgafooters;
 
 static tgaheaders *gen_header(short w, short h, colormodes mode, char RLE){
-	tgaheaders *newhdr = malloc(sizeof(tgaheaders));
+	tgaheaders *newhdr = calloc(1, sizeof(tgaheaders));
 	newhdr->idlen = 0;
 	newhdr->width = w;
 	newhdr->height = h;
@@ -622,7 +624,7 @@ TGAimage *create_image(short width, short height, image_types type){
 		mode = grayscale;
 	if(mode == incorrect)
 		return NULL;
-	TGAimage *result = malloc(sizeof(TGAimage));
+	TGAimage *result = calloc(1, sizeof(TGAimage));
 	if( result == NULL)
 		return NULL;
 	tgaheaders *blank_header = gen_header(width,height,mode,rle_enable);
@@ -816,7 +818,7 @@ TGAimage *open_image(char *filename){
 	if(filename[0] == '\0'){
 		return NULL;
 	};
-	TGAimage *result = malloc(sizeof(TGAimage));
+	TGAimage *result = calloc(1, sizeof(TGAimage));
 	if( result == NULL){
 		return NULL;
 	};
@@ -892,7 +894,7 @@ FILE *fmemopen(unsigned char arr[], unsigned int len, const char *mode);
 #endif
 
 TGAimage *open_embed_image(unsigned char arr[], unsigned int len){
-	TGAimage *result = malloc(sizeof(TGAimage));
+	TGAimage *result = calloc(1, sizeof(TGAimage));
 	if( result == NULL){
 		return NULL;
 	};
@@ -964,6 +966,9 @@ TGAimage *open_embed_image(unsigned char arr[], unsigned int len){
 };
 
 void eject_image(TGAimage *existing_image){
+	if(existing_image->mipmap != NULL)
+		eject_image(existing_image->mipmap);
+	free(existing_image->sampler);
 	if(existing_image->footer != NULL)
 		free(existing_image->footer);
 	free_canvas(existing_image->canvas);
@@ -983,8 +988,9 @@ void rescale_image(TGAimage* img, int new_width, int new_height){
 	int **new_canvas = init_canvas((short)new_height, (short)new_width);
 	for (int y = 0; y < new_height; y++) {
 		for (int x = 0; x < new_width; x++) {
-			float old_x = x * scale_x;
-			float old_y = y * scale_y;
+			//pixel centers: halving averages 2x2 blocks
+			float old_x = MAX((x + 0.5f) * scale_x - 0.5f, 0);
+			float old_y = MAX((y + 0.5f) * scale_y - 0.5f, 0);
 			int x0 = (int)old_x;
 			int y0 = (int)old_y;
 			int x1 = (x0 + 1 < old_width) ? x0 + 1 : x0;
@@ -1018,9 +1024,48 @@ void rescale_image(TGAimage* img, int new_width, int new_height){
 	}
 	free_canvas(img->canvas);
 	img->canvas = new_canvas;
+	if(img->mipmap != NULL){	//levels of the old canvas
+		eject_image(img->mipmap);
+		img->mipmap = NULL;
+	};
+	free(img->sampler);
+	img->sampler = NULL;
 	tgaheaders *dummy;
 	dummy = img->header;
 	dummy->height = (short)new_width;
 	dummy->width = (short)new_height;
 	img->header = dummy;
 }
+
+/*copy of the canvas and the header only*/
+static TGAimage *clone_image(TGAimage *image){
+	tgaheaders *hdr = (tgaheaders *)image->header;
+	TGAimage *result = calloc(1, sizeof(TGAimage));
+	if(result == NULL)
+		return NULL;
+	tgaheaders *copy = malloc(sizeof(tgaheaders));
+	memcpy(copy, hdr, sizeof(tgaheaders));
+	copy->idlen = 0;
+	result->header = (void *)copy;
+	result->canvas = init_canvas(hdr->width, hdr->height);
+	for(short w = 0; w < hdr->width; w++)
+		memcpy(result->canvas[w], image->canvas[w], hdr->height * sizeof(int));
+	return result;
+};
+
+void make_mipmaps(TGAimage *image){
+	if(image == NULL || image->mipmap != NULL)
+		return;
+	TGAimage *level = image;
+	int w = get_width(level), h = get_height(level);
+	while(w > 1 || h > 1){
+		w = MAX(w / 2, 1);
+		h = MAX(h / 2, 1);
+		TGAimage *next = clone_image(level);
+		if(next == NULL)
+			return;
+		rescale_image(next, w, h);
+		level->mipmap = next;
+		level = next;
+	};
+};
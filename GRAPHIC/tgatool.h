@@ -54,6 +54,8 @@ typedef struct tag_tga_image{
 	int *color_map;		//(OPTIONAL)
 	int **canvas;
 	struct footers *footer;//(OPTIONAL)
+	struct tag_tga_image *mipmap;//(OPTIONAL) half-sized level
+	void *sampler;		//(OPTIONAL) renderer's copy, a single block
 } TGAimage;
 //USAGE:  TGAimage *newimg1;
 
@@ -111,5 +113,13 @@ TGAimage *open_embed_image(unsigned char arr[], unsigned int len);
 void rescale_image(TGAimage* img, int new_height, int new_width);
 //USAGE:  rescale_image(img1, 600, 400);
 //NOTE:	  rescaling image canvas with bilinear interpolation
+//	  (drops the mipmaps and the sampler of the image)
+
+void make_mipmaps(TGAimage *image);
+//USAGE:  make_mipmaps(img1);
+//NOTE:	  image->mipmap, its mipmap and so on get halved copies of the
+//	  canvas down to 1x1 (by rescale_image). Does nothing if they are
+//	  already there (set_pixel does not update them).
+//	  eject_image frees them.
 
 #endif
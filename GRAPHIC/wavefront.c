@@ -34,6 +34,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
 #include "wavefront.h"
 
 enum parser_states {undefined = 0, comment, vertex, textures, normals, face};
@@ -132,9 +133,135 @@ static wavefront_obj *init_object(int v_size, int vt_size, int vn_size, int f_si
 	for(int i = 0; i <= f_size; i++){
 		result->face[i] = NULL;
 	};
+	result->mesh = NULL;
+	result->two_sided = FALSE;
 	return result;
 };
 
+static wavefront_mesh *init_mesh(int c_size, int p_size, int t_size,
+						int textured, int normals){
+	wavefront_mesh *result = malloc(sizeof(wavefront_mesh));
+	result->count = 0;
+	result->positions = 0;
+	result->triangles = t_size;
+	result->x = malloc(p_size * sizeof(float));
+	result->y = malloc(p_size * sizeof(float));
+	result->z = malloc(p_size * sizeof(float));
+	result->pos = malloc(c_size * sizeof(uint32_t));
+	result->u = NULL; result->v = NULL;
+	result->nx = NULL; result->ny = NULL; result->nz = NULL;
+	if(textured){
+		result->u = malloc(c_size * sizeof(float));
+		result->v = malloc(c_size * sizeof(float));
+	};
+	if(normals){
+		result->nx = malloc(c_size * sizeof(float));
+		result->ny = malloc(c_size * sizeof(float));
+		result->nz = malloc(c_size * sizeof(float));
+	};
+	result->index = malloc(3 * t_size * sizeof(uint32_t));
+	result->edges = malloc(t_size * sizeof(unsigned char));
+	result->clusters = (t_size + MESH_CLUSTER - 1) / MESH_CLUSTER;
+	result->cluster = malloc(result->clusters * sizeof(mesh_bounds));
+	return result;
+};
+
+/*bounds of triangles [from,to): AABB and a sphere around its center*/
+static void fit_bounds(wavefront_mesh *mesh, int from, int to, mesh_bounds *b){
+	for(int a = X; a <= Z; a++){
+		b->min[a] = FLT_MAX;
+		b->max[a] = -FLT_MAX;
+	};
+	for(int i = 3 * from; i < 3 * to; i++){
+		vector p;
+		COPY_MESH_POINT(mesh, mesh->index[i], p);
+		for(int a = X; a <= Z; a++){
+			b->min[a] = (p[a] < b->min[a])?(p[a]):(b->min[a]);
+			b->max[a] = (p[a] > b->max[a])?(p[a]):(b->max[a]);
+		};
+	};
+	float r2 = 0;
+	for(int a = X; a <= Z; a++){
+		b->center[a] = (b->min[a] + b->max[a]) / 2;
+	};
+	for(int i = 3 * from; i < 3 * to; i++){
+		vector p, d;
+		COPY_MESH_POINT(mesh, mesh->index[i], p);
+		vec_sub(p, b->center, d);
+		float l2 = vec_dot(d, d);
+		r2 = (l2 > r2)?(l2):(r2);
+	};
+	b->radius = sqrtf(r2);
+};
+
+static void update_bounds(wavefront_mesh *mesh){
+	if(mesh == NULL)
+		return;
+	fit_bounds(mesh, 0, mesh->triangles, &(mesh->bounds));
+	for(int k = 0; k < mesh->clusters; k++){
+		int end = (k + 1) * MESH_CLUSTER;
+		fit_bounds(mesh, k * MESH_CLUSTER,
+			(end < mesh->triangles)?(end):(mesh->triangles),
+			&(mesh->cluster[k]));
+	};
+};
+
+static void free_mesh(wavefront_mesh *mesh){
+	if(mesh == NULL)
+		return;
+	free(mesh->x); free(mesh->y); free(mesh->z);
+	free(mesh->pos);
+	free(mesh->u); free(mesh->v);
+	free(mesh->nx); free(mesh->ny); free(mesh->nz);
+	free(mesh->index);
+	free(mesh->edges);
+	free(mesh->cluster);
+	free(mesh);
+};
+
+typedef struct {
+	int *slot;	//corner number or -1
+	polygon **key;	//v/vt/vn of every corner
+	unsigned int mask;
+	int *position;	//position of every v or -1
+} corner_table;
+
+/*returns the corner for v/vt/vn of node, adds new one if not found*/
+static uint32_t pick_corner(wavefront_obj *obj, wavefront_mesh *mesh,
+				corner_table *t, polygon *node){
+	unsigned int h = ((unsigned int)node->v * 73856093u ^
+			  (unsigned int)node->vt * 19349663u ^
+			  (unsigned int)node->vn * 83492791u) & t->mask;
+	while(t->slot[h] != -1){
+		polygon *k = t->key[t->slot[h]];
+		if(k->v == node->v && k->vt == node->vt && k->vn == node->vn){
+			return (uint32_t)t->slot[h];
+		};
+		h = (h + 1) & t->mask;
+	};
+	int c = mesh->count++;
+	t->slot[h] = c;
+	t->key[c] = node;
+	int *p = &(t->position[node->v - 1]);
+	if(*p == -1){
+		*p = mesh->positions++;
+		mesh->x[*p] = VERTEX(obj, node->v - 1, X);
+		mesh->y[*p] = VERTEX(obj, node->v - 1, Y);
+		mesh->z[*p] = VERTEX(obj, node->v - 1, Z);
+	};
+	mesh->pos[c] = (uint32_t)*p;
+	if(mesh->u != NULL){
+		mesh->u[c] = (node->vt > 0)?(TEXTURE(obj, node->vt - 1, X)):(0);
+		mesh->v[c] = (node->vt > 0)?(TEXTURE(obj, node->vt - 1, Y)):(0);
+	};
+	if(mesh->nx != NULL){
+		mesh->nx[c] = (node->vn > 0)?(NORMAL(obj, node->vn - 1, X)):(0);
+		mesh->ny[c] = (node->vn > 0)?(NORMAL(obj, node->vn - 1, Y)):(0);
+		mesh->nz[c] = (node->vn > 0)?(NORMAL(obj, node->vn - 1, Z)):(0);
+	};
+	return (uint32_t)c;
+};
+
 typedef struct {
 	enum parser_states mode;
 	int vt_enable;
@@ -306,6 +433,7 @@ wavefront_obj *ImportObj(char *filename){
 	rewind(input);
 	parse_objfile(input, result, max[vc], max[vtc], max[vnc]);
 	fclose(input);
+	WavefrontBuildMesh(result);
 	return result;
 };
 
@@ -325,6 +453,7 @@ wavefront_obj *ImportEmbedObj(unsigned char obj[], unsigned int len){
 	rewind(input);
 	parse_objfile(input, result, max[vc], max[vtc], max[vnc]);
 	fclose(input);
+	WavefrontBuildMesh(result);
 	return result;
 };
 
@@ -357,6 +486,7 @@ void FreeObj(wavefront_obj *obj){
 	free(obj->texture);
 	free(obj->normal);
 	free(obj->face);
+	free_mesh(obj->mesh);
 	free(obj);
 };
 
@@ -448,6 +578,69 @@ void WavefrontCalculateNormals(wavefront_obj *obj){
 	for(int vn = 0; vn < v; vn++) {
 		vec_normalize(obj->normal[vn]);
 	}
+	WavefrontBuildMesh(obj);
+}
+
+void WavefrontBuildMesh(wavefront_obj *obj){
+	int corners = 0; int triangles = 0;
+	for(int i = 0; FACE(obj,i) != NULL; i++){
+		int n = 0;
+		for(polygon *cur = FACE(obj,i); cur != NULL; cur = cur->next){
+			n++;
+		};
+		if(n >= 3){
+			corners += n;
+			triangles += n - 2;
+		};
+	};
+	int vertices = 0;
+	while((obj->vertex)[vertices] != NULL){
+		vertices++;
+	};
+	free_mesh(obj->mesh);
+	wavefront_mesh *mesh = init_mesh(corners, MIN(corners, vertices),
+			triangles, obj->texture != NULL, obj->normal != NULL);
+	corner_table table;
+	table.mask = 1;
+	while(table.mask < 2 * (unsigned int)corners){
+		table.mask <<= 1;
+	};
+	table.slot = malloc(table.mask * sizeof(int));
+	memset(table.slot, 0xFF, table.mask * sizeof(int));
+	table.mask--;
+	table.key = malloc(corners * sizeof(polygon *));
+	table.position = malloc(vertices * sizeof(int));
+	memset(table.position, 0xFF, vertices * sizeof(int));
+	int t = 0;
+	for(int i = 0; FACE(obj,i) != NULL; i++){
+		polygon *fst = FACE(obj,i);
+		if(fst->next == NULL || fst->next->next == NULL)
+			continue;
+		polygon *prv = fst->next;
+		polygon *cur = prv->next;
+		uint32_t c0 = pick_corner(obj, mesh, &table, fst);
+		uint32_t c1 = pick_corner(obj, mesh, &table, prv);
+		do {
+			uint32_t c2 = pick_corner(obj, mesh, &table, cur);
+			mesh->index[3*t + 0] = c0;
+			mesh->index[3*t + 1] = c1;
+			mesh->index[3*t + 2] = c2;
+			mesh->edges[t] = EDGE_12;
+			if(prv == fst->next)
+				mesh->edges[t] |= EDGE_01;
+			if(cur->next == NULL)
+				mesh->edges[t] |= EDGE_20;
+			c1 = c2;
+			prv = cur;
+			cur = cur->next;
+			t++;
+		} while(cur != NULL);
+	};
+	free(table.slot);
+	free(table.key);
+	free(table.position);
+	obj->mesh = mesh;
+	update_bounds(mesh);
 }
 
 void TurnObj(wavefront_obj *obj, float alpha, float beta, float gamma){
@@ -471,6 +664,16 @@ void TurnObj(wavefront_obj *obj, float alpha, float beta, float gamma){
 		VERTEX(obj,n,Z) = x*g + y*h + z*i;
 		n++;
 	};
+	wavefront_mesh *m = obj->mesh;
+	for(n = 0; (m != NULL) && (n < m->positions); n++){
+		float x = m->x[n];
+		float y = m->y[n];
+		float z = m->z[n];
+		m->x[n] = x*a + y*b + z*c;
+		m->y[n] = x*d + y*e + z*f;
+		m->z[n] = x*g + y*h + z*i;
+	};
+	update_bounds(m);
 };
 
 void MoveObj(wavefront_obj *obj, float dx, float dy, float dz){
@@ -481,6 +684,13 @@ void MoveObj(wavefront_obj *obj, float dx, float dy, float dz){
 		VERTEX(obj,n,Z) += dz;
 		n++;
 	};
+	wavefront_mesh *m = obj->mesh;
+	for(n = 0; (m != NULL) && (n < m->positions); n++){
+		m->x[n] += dx;
+		m->y[n] += dy;
+		m->z[n] += dz;
+	};
+	update_bounds(m);
 };
 
 void ScaleObj(wavefront_obj *obj, float multipler){
@@ -491,4 +701,11 @@ void ScaleObj(wavefront_obj *obj, float multipler){
 		VERTEX(obj,n,Z) *= multipler;
 		n++;
 	};
+	wavefront_mesh *m = obj->mesh;
+	for(n = 0; (m != NULL) && (n < m->positions); n++){
+		m->x[n] *= multipler;
+		m->y[n] *= multipler;
+		m->z[n] *= multipler;
+	};
+	update_bounds(m);
 };
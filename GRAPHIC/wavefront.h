@@ -33,6 +33,7 @@
 #ifndef WAVEFRONT_H_SENTRY
 #define WAVEFRONT_H_SENTRY
 
+#include <stdint.h>
 #include "algebra.h" /*Takes from enum {X = 0, Y = 1, Z = 2}; VERTEX(obj,45,X)*/
 
 #define VERTEX(objptr,n,coord) ((objptr)->vertex[(n)][(coord)])
@@ -69,11 +70,59 @@ typedef struct list {
 	struct list *next;
 } polygon;
 
+/*bounds of the whole mesh or of one cluster of its triangles*/
+typedef struct {
+	vector min;		//AABB
+	vector max;
+	vector center;		//bounding sphere
+	float radius;
+} mesh_bounds;
+
+#define MESH_CLUSTER 128	//triangles per cluster (by index order)
+
+/*Flat copy of the faces for renderers: every distinct v/vt/vn triplet
+  of the file becomes one corner, every face is fan-triangulated into
+  the index buffer (3 corners per triangle). Corners sharing a v share
+  one position. See PICTURE 1.2*/
+typedef struct {
+	int count;		//number of corners
+	int positions;		//number of distinct positions
+	int triangles;		//number of triangles
+	float *x, *y, *z;	//positions
+	uint32_t *pos;		//position of every corner
+	float *u, *v;		//corner texture coords (optional)
+	float *nx, *ny, *nz;	//corner normals (optional)
+	uint32_t *index;	//triangles (3 corners each)
+	unsigned char *edges;	//EDGE_* mask of every triangle
+	mesh_bounds bounds;	//of all triangles
+	int clusters;		//(triangles + MESH_CLUSTER - 1) / MESH_CLUSTER
+	mesh_bounds *cluster;	//of every MESH_CLUSTER triangles
+} wavefront_mesh;
+
+enum {EDGE_01 = 1, EDGE_12 = 2, EDGE_20 = 4}; //edges that belong to a face
+
+#define COPY_MESH_POSITION(mesh,i,vector) do {\
+		(vector)[X] = (mesh)->x[(i)];\
+		(vector)[Y] = (mesh)->y[(i)];\
+		(vector)[Z] = (mesh)->z[(i)];\
+	}while(0)
+
+#define COPY_MESH_POINT(mesh,c,vector) \
+		COPY_MESH_POSITION(mesh,(mesh)->pos[(c)],vector)
+
+#define COPY_MESH_NORMAL(mesh,c,vector) do {\
+		(vector)[X] = (mesh)->nx[(c)];\
+		(vector)[Y] = (mesh)->ny[(c)];\
+		(vector)[Z] = (mesh)->nz[(c)];\
+	}while(0)
+
 typedef struct {
 	float **vertex;
 	float **texture; //(optional)
 	float **normal; //(optional)
 	polygon **face;
+	wavefront_mesh *mesh;
+	int two_sided;	//open mesh: back faces are not culled
 } wavefront_obj;
 
 //1. BASIC FUNCTIONS
@@ -82,6 +131,7 @@ wavefront_obj *ImportEmbedObj(unsigned char obj[], unsigned int len);
 void FreeObj(wavefront_obj *obj);
 void WavefrontPrintLog(wavefront_obj *obj);
 void WavefrontCalculateNormals(wavefront_obj *obj);
+void WavefrontBuildMesh(wavefront_obj *obj); //(re)build obj->mesh from faces
 
 //2. TRANSFORMATION PROCEDURES
 void TurnObj(wavefront_obj *obj, float alpha, float beta, float gamma);
@@ -126,4 +176,26 @@ void ScaleObj(wavefront_obj *obj, float multipler);
                                                                    +--+
 */
 
+/*PICTURE 1.2: wavefront mesh (one quad face as two triangles)
+
+   positions: one per distinct v      corners: one per distinct v/vt/vn
+      x[]   y[]   z[]                  pos[] u[]  v[]  nx[] ny[] nz[]
+    +-----+-----+-----+              +----+----+----+----+----+----+
+  0 |     |     |     |<-------------| 0  |    |    |    |    |    | 0
+    +-----+-----+-----+              +----+----+----+----+----+----+
+  1 |     |     |     |<-------------| 1  |    |    |    |    |    | 1
+    +-----+-----+-----+              +----+----+----+----+----+----+
+  2 |     |     |     |<-------------| 2  |    |    |    |    |    | 2
+    +-----+-----+-----+              +----+----+----+----+----+----+
+  3 |     |     |     |<-------------| 3  |    |    |    |    |    | 3
+    +-----+-----+-----+              +----+----+----+----+----+----+
+  . |  .  |  .  |  .  |              | .  | .  | .  | .  | .  | .  | .
+                               (a corner of another face with v of
+                                position 0 but other vt/vn also has
+                                pos = 0)
+
+    index[]: | 0 | 1 | 2 | 0 | 2 | 3 | ...   (corners of triangle 0, 1)
+    edges[]: |  EDGE_01|EDGE_12  |  EDGE_12|EDGE_20  | ...
+*/
+
 #endif
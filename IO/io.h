@@ -65,6 +65,41 @@ int io_GetPixel(window *w, int x, int y);
 void io_UpdateFrame(window *w);
 void io_CloseWindow(window *w);	//Destructor-func
 
+/*FRAMEBUFFER FUNCTIONS*/
+/*canvas of the backends that keep it in memory (xlib, winapi). Between
+  io_LockFrame and io_UnlockFrame pixels may be written straight into
+  it, without io_SetPixel calls*/
+enum {IO_FORMAT_NONE, IO_FORMAT_ARGB32}; //ARGB32: 0xAARRGGBB ints
+typedef struct {
+	int *base;	//pixel (x,y) is base[y * stride + x]
+	int stride;	//ints in a row
+	int format;	//IO_FORMAT_NONE - base is NULL
+	int width;
+	int height;
+} framebuffer;
+
+int io_LockFrame(window *w, framebuffer *fb);	//0 - no canvas in memory
+void io_UnlockFrame(window *w);
+//count pixels of row y from x, for backends without a framebuffer too
+void io_SetSpan(window *w, int x, int y, int count, const int *colors);
+
+/*PRESENTATION FUNCTIONS*/
+/*IO_PRESENT_ASYNC: io_UpdateFrame hands the finished canvas over to a
+  presentation thread and returns at once, the next frame is drawn into
+  another of three canvases (whatever it holds: redraw all of it).
+  Frames the thread had no time for are skipped*/
+enum {IO_PRESENT_SYNC, IO_PRESENT_ASYNC};
+int io_SetPresentMode(window *w, int mode);	//0 - mode is not supported
+
+/*OFFSCREEN FUNCTIONS*/
+/*io_offscreen.c only: headless canvas in memory, io_InitWindow takes
+  its size from IO_WIDTH/IO_HEIGHT environment variables*/
+typedef void (*FrameHook)(window *w, void *userdata);
+window *io_InitOffscreen(int width, int height);
+void io_SetFrameHook(window *w, FrameHook Hook, void *userdata); //called for every presented frame
+int io_GetFrame(window *w);	//frames presented so far
+int io_SaveFrame(window *w, char *filename); //TGA by tgatool, 0 - success (in the hook: the presented frame)
+
 /*CONTROL FUNCTIONS*/
 controls *io_InitControl();	//Constructor-func
 void io_PollControls(window *w, controls *c, int mode);
@@ -50,10 +50,34 @@ int io_GetPixel(window *w, int x, int y) {
 	return 0;
 }
 
+/*the terminal has no canvas in memory: spans only*/
+int io_LockFrame(window *w, framebuffer *fb) {
+	fb->base = NULL;
+	fb->stride = 0;
+	fb->format = IO_FORMAT_NONE;
+	fb->width = w->width;
+	fb->height = w->height;
+	return 0;
+}
+
+void io_UnlockFrame(window *w) {
+}
+
+void io_SetSpan(window *w, int x, int y, int count, const int *colors) {
+	move(y, x);
+	for (int i = 0; i < count; i++)
+		addch(ColorToSymbol(colors[i]));
+}
+
 void io_UpdateFrame(window *w) {
 	refresh();
 }
 
+/*the terminal is drawn by ncurses calls, they are not thread-safe*/
+int io_SetPresentMode(window *w, int mode) {
+	return mode == IO_PRESENT_SYNC;
+}
+
 void io_CloseWindow(window *w) {
 	endwin();
 	free(w);
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "io.h"
+#include "io_present.h"
+#include "../GRAPHIC/tgatool.h"
+
+/*headless backend: the canvas is an ARGB array in memory, nothing is
+  shown. Size comes from io_InitOffscreen or IO_WIDTH/IO_HEIGHT*/
+
+static int EnvSize(const char *name, int fallback);
+static void Show(window *w, int *canvas);
+static void PresentBuffer(window *w, int buffer);
+
+struct window_t{
+	int *buf;		//canvas drawn now
+	int *canvas[SWAP_BUFFERS];	//[0] only, unless presented async
+	int *shown;		//canvas the hook gets
+	swap_chain *swap;	//NULL - io_UpdateFrame presents itself
+	int width;
+	int height;
+	int frame;		//frames presented so far
+	FrameHook Hook;		//called for every presented frame, NULL - none
+	void *userdata;
+};
+
+window *io_InitOffscreen(int width, int height){
+	if(width <= 0 || height <= 0){
+		fprintf(stderr, "Wrong offscreen size %dx%d\n", width, height);
+		exit(1);
+	};
+	window *res = malloc(sizeof(window));
+	res->buf = calloc((size_t)width * height, sizeof(int));
+	if(res->buf == NULL){
+		fprintf(stderr, "Cant allocate offscreen canvas\n");
+		exit(1);
+	};
+	res->canvas[0] = res->shown = res->buf;
+	for(int i = 1; i < SWAP_BUFFERS; i++)
+		res->canvas[i] = NULL;
+	res->swap = NULL;
+	res->width = width;
+	res->height = height;
+	res->frame = 0;
+	res->Hook = NULL;
+	res->userdata = NULL;
+	return res;
+};
+
+window *io_InitWindow(){
+	return io_InitOffscreen(EnvSize("IO_WIDTH", DEFAULT_WINDOW_WIDTH),
+				EnvSize("IO_HEIGHT", DEFAULT_WINDOW_HEIGHT));
+};
+
+int io_GetWidth(window *w){
+	return w->width;
+};
+
+int io_GetHeight(window *w){
+	return w->height;
+};
+
+void io_SetPixel(window *w, int x, int y, int color){
+	w->buf[y * w->width + x] = color;
+};
+
+int io_GetPixel(window *w, int x, int y){
+	return w->buf[y * w->width + x];
+};
+
+int io_LockFrame(window *w, framebuffer *fb){
+	fb->base = w->buf;
+	fb->stride = w->width;
+	fb->format = IO_FORMAT_ARGB32;
+	fb->width = w->width;
+	fb->height = w->height;
+	return 1;
+};
+
+void io_UnlockFrame(window *w){
+};
+
+void io_SetSpan(window *w, int x, int y, int count, const int *colors){
+	memcpy(w->buf + y * w->width + x, colors, count * sizeof(int));
+};
+
+void io_UpdateFrame(window *w){
+	if(w->swap != NULL){
+		w->buf = w->canvas[SwapFrame(w->swap)];
+		return;
+	};
+	Show(w, w->buf);
+};
+
+void io_CloseWindow(window *w){
+	io_SetPresentMode(w, IO_PRESENT_SYNC);
+	free(w->buf);
+	free(w);
+};
+
+int io_SetPresentMode(window *w, int mode){
+	if(mode == IO_PRESENT_ASYNC && w->swap == NULL){
+		for(int i = 1; i < SWAP_BUFFERS; i++)
+			w->canvas[i] = calloc((size_t)w->width * w->height,
+								sizeof(int));
+		w->swap = SwapStart(w, PresentBuffer);
+	};
+	if(mode == IO_PRESENT_SYNC && w->swap != NULL){
+		int draw = SwapStop(w->swap);
+		w->swap = NULL;
+		for(int i = 0; i < SWAP_BUFFERS; i++)
+			if(i != draw)
+				free(w->canvas[i]);
+		w->canvas[0] = w->shown = w->buf;
+		for(int i = 1; i < SWAP_BUFFERS; i++)
+			w->canvas[i] = NULL;
+	};
+	return 1;
+};
+
+void io_SetFrameHook(window *w, FrameHook Hook, void *userdata){
+	w->Hook = Hook;
+	w->userdata = userdata;
+};
+
+int io_GetFrame(window *w){
+	return __atomic_load_n(&(w->frame), __ATOMIC_ACQUIRE);
+};
+
+int io_SaveFrame(window *w, char *filename){
+	/*the hook of the presentation thread saves the presented frame*/
+	int *canvas = (w->swap != NULL && SwapThread(w->swap))?
+							w->shown:w->buf;
+	/*tgatool keeps canvas[row][column] with the first row at the
+	  bottom and RGBA ints, create_image takes rows first*/
+	TGAimage *img = create_image(w->height, w->width,
+					uncompressed_truecolor);
+	if(img == NULL)
+		return -1;
+	for(int y = 0; y < w->height; y++){
+		int *row = canvas + y * w->width;
+		for(int x = 0; x < w->width; x++){
+			unsigned int c = row[x];
+			img->canvas[w->height - 1 - y][x] = (c << 8) | (c >> 24);
+		};
+	};
+	int res = save_image(img, filename);
+	eject_image(img);
+	return res;
+};
+
+controls *io_InitControl(){
+	controls *c = malloc(sizeof(controls));
+	c->type = none;
+	for(int i = 0; i < MAX_KEYS; i++){
+		HOLD(c,i) = 0;
+		TOGGLE(c, i) = 0;
+	};
+	c->x = 0; c->y = 0;
+	return c;
+};
+
+/*no input devices: nothing ever happens, BLOCK_POLL does not wait*/
+void io_PollControls(window *w, controls *c, int mode){
+	c->type = none;
+};
+
+/*STATIC FUNCTIONS*/
+static void Show(window *w, int *canvas){
+	w->shown = canvas;
+	if(w->Hook != NULL)
+		(w->Hook)(w, w->userdata);
+	__atomic_add_fetch(&(w->frame), 1, __ATOMIC_RELEASE);
+};
+
+static void PresentBuffer(window *w, int buffer){
+	Show(w, w->canvas[buffer]);
+};
+
+static int EnvSize(const char *name, int fallback){
+	char *value = getenv(name);
+	if(value == NULL || atoi(value) <= 0)
+		return fallback;
+	return atoi(value);
+};
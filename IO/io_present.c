@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include "io_present.h"
+
+static void *PresentLoop(void *data);
+
+swap_chain *SwapStart(window *w, PresentFunc Present){
+	swap_chain *s = malloc(sizeof(swap_chain));
+	s->draw = 0;
+	s->ready = 1;
+	s->shown = 2;
+	s->quit = 0;
+	s->paused = 0;
+	s->idle = 0;
+	s->w = w;
+	s->Present = Present;
+	pthread_mutex_init(&(s->lock), NULL);
+	pthread_cond_init(&(s->wake), NULL);
+	pthread_cond_init(&(s->rest), NULL);
+	pthread_create(&(s->thread), NULL, PresentLoop, s);
+	return s;
+};
+
+int SwapFrame(swap_chain *s){
+	int old = __atomic_exchange_n(&(s->ready), s->draw | SWAP_FRESH,
+							__ATOMIC_ACQ_REL);
+	s->draw = old & ~SWAP_FRESH;
+	pthread_mutex_lock(&(s->lock));
+	pthread_cond_signal(&(s->wake));
+	pthread_mutex_unlock(&(s->lock));
+	return s->draw;
+};
+
+int SwapStop(swap_chain *s){
+	pthread_mutex_lock(&(s->lock));
+	s->quit = 1;
+	pthread_cond_signal(&(s->wake));
+	pthread_mutex_unlock(&(s->lock));
+	pthread_join(s->thread, NULL);
+	int draw = s->draw;
+	pthread_mutex_destroy(&(s->lock));
+	pthread_cond_destroy(&(s->wake));
+	pthread_cond_destroy(&(s->rest));
+	free(s);
+	return draw;
+};
+
+void SwapPause(swap_chain *s){
+	pthread_mutex_lock(&(s->lock));
+	s->paused = 1;
+	pthread_cond_signal(&(s->wake));
+	while(!s->idle)
+		pthread_cond_wait(&(s->rest), &(s->lock));
+	pthread_mutex_unlock(&(s->lock));
+	__atomic_and_fetch(&(s->ready), ~SWAP_FRESH, __ATOMIC_ACQ_REL);
+};
+
+void SwapResume(swap_chain *s){
+	pthread_mutex_lock(&(s->lock));
+	s->paused = 0;
+	pthread_cond_signal(&(s->wake));
+	pthread_mutex_unlock(&(s->lock));
+};
+
+int SwapThread(swap_chain *s){
+	return pthread_equal(pthread_self(), s->thread);
+};
+
+static void *PresentLoop(void *data){
+	swap_chain *s = (swap_chain *)data;
+	for(;;){
+		pthread_mutex_lock(&(s->lock));
+		while((s->paused || !(__atomic_load_n(&(s->ready),
+			__ATOMIC_ACQUIRE) & SWAP_FRESH)) && !s->quit){
+			if(s->paused && !s->idle){
+				s->idle = 1;
+				pthread_cond_signal(&(s->rest));
+			};
+			pthread_cond_wait(&(s->wake), &(s->lock));
+		};
+		s->idle = 0;
+		int quit = s->quit, paused = s->paused;
+		pthread_mutex_unlock(&(s->lock));
+		if(!paused && (__atomic_load_n(&(s->ready), __ATOMIC_ACQUIRE)
+							& SWAP_FRESH)){
+			int old = __atomic_exchange_n(&(s->ready), s->shown,
+							__ATOMIC_ACQ_REL);
+			s->shown = old & ~SWAP_FRESH;
+			(s->Present)(s->w, s->shown);
+		};
+		if(quit)
+			break;
+	};
+	return NULL;
+};
@@ -0,0 +1,78 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2024
+ *	Potr Dervyshev.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *	@(#)io_present.h	1.0 (Potr Dervyshev) 17/10/2026
+ */
+/* TRIPLE-BUFFERED PRESENTATION THREAD FOR THE BACKENDS */
+#ifndef PRESENT_H_SENTRY
+#define PRESENT_H_SENTRY
+#include <pthread.h>
+#include "io.h"
+
+/*three canvases: the renderer draws one, the thread shows another and
+  the last finished frame waits in the third. Finished frames are
+  handed over by one atomic exchange of `ready`, neither side ever waits
+  for the other, frames the thread had no time for are dropped*/
+#define SWAP_BUFFERS 3
+#define SWAP_FRESH 4		//flag of ready: it holds an unshown frame
+
+typedef void (*PresentFunc)(window *w, int buffer);
+
+typedef struct {
+	int draw;		//buffer of the renderer
+	int shown;		//buffer of the thread
+	int ready;		//buffer in between (| SWAP_FRESH)
+	int quit;
+	int paused;		//the thread must not present
+	int idle;		//the thread saw paused and sleeps
+	pthread_t thread;
+	pthread_mutex_t lock;	//only to sleep while there is nothing new
+	pthread_cond_t wake;
+	pthread_cond_t rest;	//the thread went idle
+	window *w;
+	PresentFunc Present;	//shows buffer on the screen
+} swap_chain;
+
+/*starts the thread, renderer draws into buffer 0 first*/
+swap_chain *SwapStart(window *w, PresentFunc Present);
+/*hands the drawn buffer over, returns the buffer to draw next*/
+int SwapFrame(swap_chain *s);
+/*shows the last finished frame and stops the thread, returns the
+  buffer the renderer drew into*/
+int SwapStop(swap_chain *s);
+/*waits until the thread presents nothing, then the renderer may change
+  every buffer. An unshown frame is dropped*/
+void SwapPause(swap_chain *s);
+/*lets the paused thread present again*/
+void SwapResume(swap_chain *s);
+/*called from the presentation thread?*/
+int SwapThread(swap_chain *s);
+
+#endif
@@ -2,9 +2,13 @@
 #include <windowsx.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "io.h"
+#include "io_present.h"
 
 static int ConvertKeysyms(int keysym);
+static void PutCanvas(window *w, unsigned char *canvas);
+static void PresentBuffer(window *w, int buffer);
 
 
 #define MAX_PATH_LENGTH 512
@@ -46,7 +50,9 @@ struct window_t {
 	int width;
 	int height;
 	BITMAPINFO bmi;
-	unsigned char *buf;
+	unsigned char *buf;	//canvas drawn now
+	unsigned char *canvas[SWAP_BUFFERS];	//[0] only, unless async
+	swap_chain *swap;	//NULL - io_UpdateFrame presents itself
 };
 
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
@@ -82,6 +88,8 @@ window *io_InitWindow() {
 	res->bmi.bmiHeader.biClrUsed = 0;
 	res->bmi.bmiHeader.biClrImportant = 0;
 	res->buf = malloc(res->width * res->height * 4);
+	res->canvas[0] = res->buf;
+	res->swap = NULL;
 	res->hwnd = hwnd;
 	res->hdc = hdc;
 	return res;
@@ -104,17 +112,54 @@ void io_SetPixel(window *w, int x, int y, int color) {
 	w->buf[index + 3] = (color >> 24) & 0xFF; // Alpha
 }
 
+int io_GetPixel(window *w, int x, int y) {
+	return ((int *)w->buf)[y * w->width + x];
+}
+
+/*BGRA bytes of the DIB are ARGB ints on little-endian Windows*/
+int io_LockFrame(window *w, framebuffer *fb) {
+	fb->base = (int *)w->buf;
+	fb->stride = w->width;
+	fb->format = IO_FORMAT_ARGB32;
+	fb->width = w->width;
+	fb->height = w->height;
+	return 1;
+}
+
+void io_UnlockFrame(window *w) {
+}
+
+void io_SetSpan(window *w, int x, int y, int count, const int *colors) {
+	memcpy((int *)w->buf + y * w->width + x, colors, count * sizeof(int));
+}
+
 void io_UpdateFrame(window *w) {
-	HDC hdcMem = CreateCompatibleDC(w->hdc);
-	HBITMAP hBitmap = CreateCompatibleBitmap(w->hdc, w->width, w->height);
-	SelectObject(hdcMem, hBitmap);
-	SetDIBitsToDevice(w->hdc, 0, 0, w->width, w->height,
-			0, 0, 0, w->height, w->buf, &w->bmi, DIB_RGB_COLORS);
-	DeleteDC(hdcMem);
-	DeleteObject(hBitmap);
+	if (w->swap != NULL) {
+		w->buf = w->canvas[SwapFrame(w->swap)];
+		return;
+	}
+	PutCanvas(w, w->buf);
+}
+
+int io_SetPresentMode(window *w, int mode) {
+	if (mode == IO_PRESENT_ASYNC && w->swap == NULL) {
+		for (int i = 1; i < SWAP_BUFFERS; i++)
+			w->canvas[i] = malloc(w->width * w->height * 4);
+		w->swap = SwapStart(w, PresentBuffer);
+	}
+	if (mode == IO_PRESENT_SYNC && w->swap != NULL) {
+		int draw = SwapStop(w->swap);
+		w->swap = NULL;
+		for (int i = 0; i < SWAP_BUFFERS; i++)
+			if (i != draw)
+				free(w->canvas[i]);
+		w->canvas[0] = w->buf;
+	}
+	return 1;
 }
 
 void io_CloseWindow(window *w) {
+	io_SetPresentMode(w, IO_PRESENT_SYNC);
 	free(w->buf);
 	ReleaseDC(w->hwnd, w->hdc);
 	DestroyWindow(w->hwnd);
@@ -201,6 +246,20 @@ void io_PollControls(window *w, controls *c, int mode) {
 }
 
 /*STATIC FUNCTIONS*/
+static void PutCanvas(window *w, unsigned char *canvas) {
+	HDC hdcMem = CreateCompatibleDC(w->hdc);
+	HBITMAP hBitmap = CreateCompatibleBitmap(w->hdc, w->width, w->height);
+	SelectObject(hdcMem, hBitmap);
+	SetDIBitsToDevice(w->hdc, 0, 0, w->width, w->height,
+			0, 0, 0, w->height, canvas, &w->bmi, DIB_RGB_COLORS);
+	DeleteDC(hdcMem);
+	DeleteObject(hBitmap);
+}
+
+static void PresentBuffer(window *w, int buffer) {
+	PutCanvas(w, w->canvas[buffer]);
+}
+
 static int ConvertKeysyms(int keysym) {
 	// You can customize this mapping according to your key handling needs.
 	if (keysym >= '0' && keysym <= '9') {
@@ -2,25 +2,53 @@
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
 #include <X11/XKBlib.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "io.h"
+#include "io_present.h"
+
+typedef struct {
+	XImage *img;
+	int shared;		//img is in MIT-SHM memory, else malloc'ed
+	XShmSegmentInfo shm;
+	int bytes;		//size of the memory, img may use less
+} canvas;
+
+#define CANVAS_STEP 64	//canvas memory is allocated for sizes rounded up to it
 
 static int ConvertKeysyms(int keysym);
 static void DisableKeyRepeat(Display *display);
 static void EnableKeyRepeat(Display *display);
+static int DirectImage(XImage *img);
+static void CreateCanvas(window *w, canvas *c);
+static void FitCanvas(window *w, canvas *c);
+static void ResizeCanvas(window *w);
+static void DestroyCanvas(window *w, canvas *c);
+static int SharedCanvas(window *w, canvas *c);
+static int ShmError(Display *dsp, XErrorEvent *e);
+static void PutCanvas(window *w, canvas *c);
+static void PresentBuffer(window *w, int buffer);
 
 struct window_t{
 	Display *dsp;
 	Window win;
 	int scr;
 	GC gc;
-	XImage *buf;
+	XImage *buf;		//image drawn now
+	canvas canvas[SWAP_BUFFERS];	//[0] only, unless presented async
+	swap_chain *swap;	//NULL - io_UpdateFrame presents itself
 	int width;
 	int height;
+	int pending_width;	//size of the last ConfigureNotify, applied
+	int pending_height;	//once per frame by io_UpdateFrame
 };
 
 window *io_InitWindow(){
+	XInitThreads();		//the presentation thread draws too
 	Display *dsp = XOpenDisplay(NULL);
 	if (dsp == NULL) {
 		fprintf(stderr, "Cant open display\n");
@@ -39,15 +67,15 @@ window *io_InitWindow(){
 	window *res = malloc(sizeof(window));
 	res->width = DEFAULT_WINDOW_WIDTH;
 	res->height = DEFAULT_WINDOW_HEIGHT;
-	char *canvas = malloc(res->width * res->height * sizeof(int));
-	XImage *buffer = XCreateImage(dsp, DefaultVisual(dsp, scr),
-			DefaultDepth(dsp, scr),ZPixmap, 0, 
-			canvas, res->width, res->height, 32, 0);
+	res->pending_width = res->width;
+	res->pending_height = res->height;
 	res->win = win;
 	res->dsp = dsp;
 	res->scr = scr;
 	res->gc = gc;
-	res->buf = buffer;
+	res->swap = NULL;
+	CreateCanvas(res, &(res->canvas[0]));
+	res->buf = res->canvas[0].img;
 	return res;
 };
 
@@ -67,14 +95,66 @@ int io_GetPixel(window *w, int x, int y){
 	return (int)XGetPixel(w->buf,x,y);
 };
 
+int io_LockFrame(window *w, framebuffer *fb){
+	fb->width = w->width;
+	fb->height = w->height;
+	if(!DirectImage(w->buf)){
+		fb->base = NULL;
+		fb->stride = 0;
+		fb->format = IO_FORMAT_NONE;
+		return 0;
+	};
+	fb->base = (int *)w->buf->data;
+	fb->stride = w->buf->bytes_per_line / sizeof(int);
+	fb->format = IO_FORMAT_ARGB32;
+	return 1;
+};
+
+void io_UnlockFrame(window *w){
+};
+
+void io_SetSpan(window *w, int x, int y, int count, const int *colors){
+	if(DirectImage(w->buf)){
+		memcpy(w->buf->data + y * w->buf->bytes_per_line +
+				x * sizeof(int), colors, count * sizeof(int));
+		return;
+	};
+	for(int i = 0; i < count; i++)
+		XPutPixel(w->buf, x + i, y, colors[i]);
+};
+
 void io_UpdateFrame(window *w){
-	XPutImage(w->dsp, w->win, w->gc, w->buf,
-		  0, 0, 0, 0, io_GetWidth(w), io_GetHeight(w));
+	int draw = 0;
+	if(w->swap != NULL)
+		draw = SwapFrame(w->swap);
+	else
+		PutCanvas(w, &(w->canvas[0]));
+	if(w->pending_width != w->width || w->pending_height != w->height)
+		ResizeCanvas(w);
+	w->buf = w->canvas[draw].img;
+};
+
+int io_SetPresentMode(window *w, int mode){
+	if(mode == IO_PRESENT_ASYNC && w->swap == NULL){
+		for(int i = 1; i < SWAP_BUFFERS; i++)
+			CreateCanvas(w, &(w->canvas[i]));
+		w->swap = SwapStart(w, PresentBuffer);
+	};
+	if(mode == IO_PRESENT_SYNC && w->swap != NULL){
+		int draw = SwapStop(w->swap);
+		w->swap = NULL;
+		for(int i = 0; i < SWAP_BUFFERS; i++)
+			if(i != draw)
+				DestroyCanvas(w, &(w->canvas[i]));
+		w->canvas[0] = w->canvas[draw];
+	};
+	return 1;
 };
 
 void io_CloseWindow(window *w){
 	EnableKeyRepeat(w->dsp);
-	XDestroyImage(w->buf);
+	io_SetPresentMode(w, IO_PRESENT_SYNC);
+	DestroyCanvas(w, &(w->canvas[0]));
 	XFreeGC(w->dsp, w->gc);
 	XDestroyWindow(w->dsp, w->win);
 	XCloseDisplay(w->dsp);
@@ -131,22 +211,142 @@ void io_PollControls(window *w, controls *c, int mode){
 			MOUSE_Y(c) = e.xmotion.y;
 		}
 		if (e.type == ConfigureNotify) {
-			XWindowAttributes a;
-			XGetWindowAttributes(w->dsp,w->win,&a);
-			w->width = a.width;
-			w->height = a.height;
-			XDestroyImage(w->buf);
-			char *canvas = malloc(w->width*w->height*sizeof(int));
-			XImage *new_buffer = XCreateImage(w->dsp, 
-					DefaultVisual(w->dsp, w->scr),
-					DefaultDepth(w->dsp, w->scr),ZPixmap,0, 
-					canvas, w->width, w->height, 32, 0);
-			w->buf = new_buffer;
+			/*a drag sends dozens of these: only the last size
+			  counts, the canvas follows it in io_UpdateFrame*/
+			w->pending_width = e.xconfigure.width;
+			w->pending_height = e.xconfigure.height;
 		}
 	}
 };
 
 /*STATIC FUNCTIONS*/
+/*canvas of the window size: shared with the server if MIT-SHM works
+  (local display), else an ordinary image sent by XPutImage. The memory
+  is enough for the size rounded up to CANVAS_STEP, so a growing window
+  does not reallocate it on every frame*/
+static void CreateCanvas(window *w, canvas *c){
+	int width = (w->width + CANVAS_STEP - 1) / CANVAS_STEP * CANVAS_STEP;
+	int height = (w->height + CANVAS_STEP - 1) / CANVAS_STEP * CANVAS_STEP;
+	c->bytes = width * height * sizeof(int);
+	if(SharedCanvas(w, c)){
+		c->shared = 1;
+		return;
+	};
+	c->shared = 0;
+	char *data = malloc(c->bytes);
+	c->img = XCreateImage(w->dsp, DefaultVisual(w->dsp, w->scr),
+			DefaultDepth(w->dsp, w->scr), ZPixmap, 0,
+			data, w->width, w->height, 32, 0);
+}
+
+/*the canvas takes the window size, keeping its memory if it is enough*/
+static void FitCanvas(window *w, canvas *c){
+	XImage *img = c->img;
+	int line = (w->width * img->bits_per_pixel + img->bitmap_pad - 1) /
+				img->bitmap_pad * (img->bitmap_pad / 8);
+	if(line * w->height > c->bytes){
+		DestroyCanvas(w, c);
+		CreateCanvas(w, c);
+		return;
+	};
+	img->width = w->width;
+	img->height = w->height;
+	img->bytes_per_line = line;
+}
+
+/*applies the last ConfigureNotify: the presentation thread must not
+  put a canvas while it changes, so it is paused for that frame*/
+static void ResizeCanvas(window *w){
+	int async = (w->swap != NULL);
+	if(async)
+		SwapPause(w->swap);
+	w->width = w->pending_width;
+	w->height = w->pending_height;
+	for(int i = 0; i < (async?SWAP_BUFFERS:1); i++)
+		FitCanvas(w, &(w->canvas[i]));
+	if(async)
+		SwapResume(w->swap);
+}
+
+static void DestroyCanvas(window *w, canvas *c){
+	if(!c->shared){
+		XDestroyImage(c->img);
+		return;
+	};
+	XShmDetach(w->dsp, &(c->shm));
+	XDestroyImage(c->img);	//leaves the segment alone
+	shmdt(c->shm.shmaddr);
+}
+
+static void PutCanvas(window *w, canvas *c){
+	if(c->shared){
+		/*the server reads the canvas itself: wait until it is done
+		  before the next frame is drawn into it*/
+		XShmPutImage(w->dsp, w->win, w->gc, c->img,
+			0, 0, 0, 0, io_GetWidth(w), io_GetHeight(w), False);
+		XSync(w->dsp, False);
+		return;
+	};
+	XPutImage(w->dsp, w->win, w->gc, c->img,
+		  0, 0, 0, 0, io_GetWidth(w), io_GetHeight(w));
+	XFlush(w->dsp);
+}
+
+static void PresentBuffer(window *w, int buffer){
+	PutCanvas(w, &(w->canvas[buffer]));
+}
+
+static int shm_failed;
+static int ShmError(Display *dsp, XErrorEvent *e){
+	shm_failed = 1;
+	return 0;
+}
+
+static int SharedCanvas(window *w, canvas *c){
+	if(!XShmQueryExtension(w->dsp))
+		return 0;
+	XImage *img = XShmCreateImage(w->dsp, DefaultVisual(w->dsp, w->scr),
+			DefaultDepth(w->dsp, w->scr), ZPixmap, NULL,
+			&(c->shm), w->width, w->height);
+	if(img == NULL)
+		return 0;
+	c->shm.shmid = shmget(IPC_PRIVATE, c->bytes, IPC_CREAT | 0600);
+	if(c->shm.shmid < 0){
+		XDestroyImage(img);
+		return 0;
+	};
+	c->shm.shmaddr = img->data = shmat(c->shm.shmid, NULL, 0);
+	c->shm.readOnly = False;
+	/*a remote server fails the attach asynchronously: catch it here*/
+	shm_failed = (c->shm.shmaddr == (char *)-1);
+	if(!shm_failed){
+		XErrorHandler Old = XSetErrorHandler(ShmError);
+		XShmAttach(w->dsp, &(c->shm));
+		XSync(w->dsp, False);
+		XSetErrorHandler(Old);
+	};
+	/*the segment goes away with its last user*/
+	shmctl(c->shm.shmid, IPC_RMID, NULL);
+	if(shm_failed){
+		if(c->shm.shmaddr != (char *)-1)
+			shmdt(c->shm.shmaddr);
+		img->data = NULL;
+		XDestroyImage(img);
+		return 0;
+	};
+	c->img = img;
+	return 1;
+}
+
+/*pixels of img are 0x00RRGGBB ints of this machine*/
+static int DirectImage(XImage *img){
+	int one = 1;
+	int order = (*(char *)&one)?(LSBFirst):(MSBFirst);
+	return img->bits_per_pixel == 32 && img->byte_order == order &&
+		img->red_mask == 0xFF0000 && img->green_mask == 0xFF00 &&
+		img->blue_mask == 0xFF;
+}
+
 static void DisableKeyRepeat(Display *display){
 	XKeyboardControl control;
 	control.auto_repeat_mode = AutoRepeatModeOff;
@@ -1,8 +1,9 @@
 mkdir .\build
 gcc -c IO\io_winapi.c -o build\io.o 
+gcc -c IO\io_present.c -o build\present.o 
 gcc -c GRAPHIC\tgatool.c -o build\tgatool.o 
 gcc -c GRAPHIC\algebra.c -o build\algebra.o -D_FIXED_POINT
 gcc -c GRAPHIC\wavefront.c -o build\wavefront.o 
-gcc -c GRAPHIC\basics.c -o build\basics.o -D_FIXED_POINT
+gcc -c GRAPHIC\basics.c -o build\basics.o -D_FIXED_POINT -D_HALFSPACE
 gcc -c GRAPHIC\render3d.c -o build\render3d.o 
-gcc -static -o run.exe main.c build\* -lm -lgdi32 -luser32 -mwindows
\ No newline at end of file
+gcc -static -o run.exe main.c build\* -lm -lpthread -lgdi32 -luser32 -mwindows
\ No newline at end of file
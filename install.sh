@@ -1,10 +1,19 @@
 #!/bin/sh
+# usage: ./install.sh [xlib|ncurses|offscreen]
 
+IO=${1:-xlib}
+case $IO in
+	xlib) LIBS="-lX11 -lXext";;
+	ncurses) LIBS=-lncurses;;
+	offscreen) LIBS=;;
+	*) echo "unknown backend $IO"; exit 1;;
+esac
 mkdir ./build
-cc -c IO/io_xlib.c -o build/io.o -O3 -I/usr/local/include/  -D_FIXED_POINT
+cc -c IO/io_$IO.c -o build/io.o -O3 -I/usr/local/include/  -D_FIXED_POINT
+cc -c IO/io_present.c -o build/present.o -O3 -I/usr/local/include/ 
 cc -c GRAPHIC/algebra.c -o build/algebra.o -O3 -I/usr/local/include/ 
 cc -c GRAPHIC/tgatool.c -o build/tgatool.o -O3 -I/usr/local/include/ 
 cc -c GRAPHIC/wavefront.c -o build/wavefront.o -O3 -I/usr/local/include/ 
-cc -c GRAPHIC/basics.c -o build/basics.o -O3 -I/usr/local/include/ -D_FIXED_POINT
+cc -c GRAPHIC/basics.c -o build/basics.o -O3 -I/usr/local/include/ -D_FIXED_POINT -D_HALFSPACE
 cc -c GRAPHIC/render3d.c -o build/render3d.o -O3 -I/usr/local/include/ 
-cc -o run main.c build/* -O3 -L/usr/local/lib -lX11 -lm 
+cc -o run main.c build/* -O3 -L/usr/local/lib $LIBS -lm -lpthread
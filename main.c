@@ -23,6 +23,7 @@ int main(){
 		return 1;
 	}
 	window *w = io_InitWindow();
+	io_SetPresentMode(w, IO_PRESENT_ASYNC); /*every frame is redrawn*/
 	camera *cam = InitCamera(w,0,0,0,0,0,0,400);
 	float t = 0;
 	while(1){
@@ -37,7 +38,7 @@ int main(){
 		//RenderShaded(w, cam, obj, 0xFFAA0000);
 		//RenderTextured(w, cam, obj, texture);
 		RenderGouraud(w, cam, obj, texture, 0xFF212121);
-		//RenderZBuffer(w, cam, obj, 8000);
+		//RenderZBuffer(w, cam, obj, 500);
 		//RenderWireframe(w, cam, obj, 0xFF121212);
 		io_UpdateFrame(w);
 	};